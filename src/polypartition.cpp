@@ -24,96 +24,1338 @@
 #include "polypartition.h"
 
 #include <math.h>
+#include <stdio.h>
 #include <string.h>
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <limits>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#include <immintrin.h>
+#endif
+
+#ifdef TPPL_NAMESPACE
+namespace TPPL_NAMESPACE {
+#endif
+
+#ifdef TPPL_STATS
+// Statistics counted into by the current thread, set by TPPLStatsScope
+// for the methods of a partition and by TPPLRunThreads for its workers.
+static thread_local TPPLStats *tpplstats = NULL;
+
+// Makes stats current for its lifetime. If stats is NULL, the current
+// statistics are kept, as for the partitions used by worker threads.
+class TPPLStatsScope {
+  TPPLStats *previous;
+
+  public:
+  TPPLStatsScope(TPPLStats *stats) :
+          previous(tpplstats) {
+    if (stats) {
+      tpplstats = stats;
+    }
+  }
+
+  ~TPPLStatsScope() {
+    tpplstats = previous;
+  }
+};
+
+// Adds the time until Stop is called, or until its destruction,
+// to a field of the current statistics.
+class TPPLStatsTimer {
+  TPPLStats *stats;
+  double TPPLStats::*field;
+  std::chrono::steady_clock::time_point start;
+
+  public:
+  TPPLStatsTimer(double TPPLStats::*field) :
+          stats(tpplstats), field(field) {
+    if (stats) {
+      start = std::chrono::steady_clock::now();
+    }
+  }
+
+  ~TPPLStatsTimer() {
+    Stop();
+  }
+
+  void Stop() {
+    if (stats) {
+      stats->*field += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+      stats = NULL;
+    }
+  }
+};
+
+#define TPPL_STATS_ADD(field, n) \
+  do { \
+    if (tpplstats) { \
+      tpplstats->field += (n); \
+    } \
+  } while (0)
+#define TPPL_STATS_SCOPE() TPPLStatsScope tpplstatsscope(stats)
+#define TPPL_STATS_TIMER(timer, field) TPPLStatsTimer timer(&TPPLStats::field)
+#define TPPL_STATS_STOP(timer) timer.Stop()
+#else
+#define TPPL_STATS_ADD(field, n) \
+  do { \
+  } while (0)
+#define TPPL_STATS_SCOPE()
+#define TPPL_STATS_TIMER(timer, field)
+#define TPPL_STATS_STOP(timer)
+#endif
+
+// Allocates an array of n elements, from workspace if not NULL,
+// otherwise through TPPL_ALLOCATOR if defined.
+template <class T>
+static T *TPPLNewArray(long n, TPPLWorkspace *workspace = NULL) {
+  if (workspace) {
+    T *array = (T *)workspace->Allocate(n * sizeof(T));
+    for (long i = 0; i < n; i++) {
+      new (array + i) T;
+    }
+    return array;
+  }
+  TPPL_STATS_ADD(numbytesallocated, n * sizeof(T));
+#ifdef TPPL_ALLOCATOR
+  TPPL_ALLOCATOR(T) allocator;
+  T *array = allocator.allocate(n);
+  for (long i = 0; i < n; i++) {
+    new (array + i) T;
+  }
+  return array;
+#else
+  return new T[n];
+#endif
+}
+
+// Frees an array allocated by TPPLNewArray. Workspace memory itself is
+// only reclaimed by TPPLWorkspace::Release.
+template <class T>
+static void TPPLDeleteArray(T *array, long n, TPPLWorkspace *workspace = NULL) {
+  if (workspace) {
+    for (long i = 0; i < n; i++) {
+      array[i].~T();
+    }
+    return;
+  }
+#ifdef TPPL_ALLOCATOR
+  if (!array) {
+    return;
+  }
+  TPPL_ALLOCATOR(T) allocator;
+  for (long i = 0; i < n; i++) {
+    array[i].~T();
+  }
+  allocator.deallocate(array, n);
+#else
+  (void)n;
+  delete[] array;
+#endif
+}
+
+// Runs worker(0) to worker(numthreads - 1) in parallel, worker(0) on the
+// calling thread, and waits for all of them to finish.
+static void TPPLRunThreads(int numthreads, const std::function<void(int)> &worker) {
+  std::thread *threads;
+  int i;
+
+  if (numthreads <= 1) {
+    worker(0);
+    return;
+  }
+  threads = TPPLNewArray<std::thread>(numthreads - 1);
+#ifdef TPPL_STATS
+  // The other threads count into statistics of their own, which are
+  // added to the current ones at the end.
+  TPPLStats *threadstats = NULL;
+  if (tpplstats) {
+    threadstats = TPPLNewArray<TPPLStats>(numthreads - 1);
+  }
+  for (i = 1; i < numthreads; i++) {
+    threads[i - 1] = std::thread([&worker, threadstats, i]() {
+      tpplstats = threadstats ? threadstats + i - 1 : NULL;
+      worker(i);
+    });
+  }
+#else
+  for (i = 1; i < numthreads; i++) {
+    threads[i - 1] = std::thread(worker, i);
+  }
+#endif
+  worker(0);
+  for (i = 1; i < numthreads; i++) {
+    threads[i - 1].join();
+  }
+  TPPLDeleteArray(threads, numthreads - 1);
+#ifdef TPPL_STATS
+  if (threadstats) {
+    for (i = 1; i < numthreads; i++) {
+      tpplstats->Add(threadstats[i - 1]);
+    }
+    TPPLDeleteArray(threadstats, numthreads - 1);
+  }
+#endif
+}
+
+// Runs worker(thread, job) for jobs order[0] to order[numjobs - 1] on
+// numthreads threads. The jobs are dealt round-robin to one queue per
+// thread, so each queue starts with the front of order. A thread whose
+// queue is empty steals the remaining jobs of the other queues.
+static void TPPLRunBatch(int numthreads, long numjobs, const long *order,
+        const std::function<void(int, long)> &worker) {
+  std::atomic<long> *next;
+  int i;
+
+  next = TPPLNewArray<std::atomic<long> >(numthreads);
+  for (i = 0; i < numthreads; i++) {
+    next[i] = 0;
+  }
+  TPPLRunThreads(numthreads, [&](int thread) {
+    long j, k;
+    int q, queue;
+    for (q = 0; q < numthreads; q++) {
+      queue = (thread + q) % numthreads;
+      for (;;) {
+        k = next[queue].fetch_add(1);
+        j = queue + k * numthreads;
+        if (j >= numjobs) {
+          break;
+        }
+        worker(thread, order[j]);
+      }
+    }
+  });
+  TPPLDeleteArray(next, numthreads);
+}
+
+// Barrier for the threads started by TPPLRunThreads. It spins, as the
+// threads only wait for each other for short periods.
+class TPPLBarrier {
+  std::atomic<int> count;
+  std::atomic<int> generation;
+  int numthreads;
+
+  public:
+  TPPLBarrier(int numthreads) :
+          count(0), generation(0), numthreads(numthreads) {}
+
+  void Wait() {
+    int g = generation;
+    if (count.fetch_add(1) + 1 == numthreads) {
+      count = 0;
+      generation++;
+    } else {
+      while (generation == g) {
+        std::this_thread::yield();
+      }
+    }
+  }
+};
+
+// Computes a + b exactly, as sum + err.
+static inline void TPPLTwoSum(tppl_float a, tppl_float b, tppl_float &sum, tppl_float &err) {
+  tppl_float x, bvirtual, avirtual;
+  x = a + b;
+  bvirtual = x - a;
+  avirtual = x - bvirtual;
+  err = (a - avirtual) + (b - bvirtual);
+  sum = x;
+}
+
+// Computes a - b exactly, as diff + err.
+static inline void TPPLTwoDiff(tppl_float a, tppl_float b, tppl_float &diff, tppl_float &err) {
+  tppl_float x, bvirtual, avirtual;
+  x = a - b;
+  bvirtual = a - x;
+  avirtual = x + bvirtual;
+  err = (a - avirtual) + (bvirtual - b);
+  diff = x;
+}
+
+// Returns the sign of the orientation determinant of p1, p2, p3, computed
+// exactly: the products of the coordinates are split into pairs of
+// floats by fused multiply-add and summed as a floating-point expansion,
+// as in J. R. Shewchuk, "Adaptive Precision Floating-Point Arithmetic
+// and Fast Robust Geometric Predicates".
+static tppl_float TPPLOrient2DExact(const TPPLPoint &p1, const TPPLPoint &p2, const TPPLPoint &p3) {
+  tppl_float products[6][2] = {
+    { p2.x, p3.y }, { -p2.x, p1.y }, { -p1.x, p3.y },
+    { -p2.y, p3.x }, { p1.x, p2.y }, { p1.y, p3.x }
+  };
+  tppl_float terms[12], expansion[12];
+  tppl_float q, h;
+  tppl_float dx2, dy2, dx3, dy3, errx2, erry2, errx3, erry3, detleft, detright;
+  long i, j, n, m;
+
+  // If the differences and their products are exact, as with integer
+  // coordinates, the floating-point result has the right sign.
+  TPPLTwoDiff(p2.x, p1.x, dx2, errx2);
+  TPPLTwoDiff(p2.y, p1.y, dy2, erry2);
+  TPPLTwoDiff(p3.x, p1.x, dx3, errx3);
+  TPPLTwoDiff(p3.y, p1.y, dy3, erry3);
+  if ((errx2 == 0) && (erry2 == 0) && (errx3 == 0) && (erry3 == 0)) {
+    detleft = dx2 * dy3;
+    detright = dy2 * dx3;
+    if ((tppl_fma(dx2, dy3, -detleft) == 0) && (tppl_fma(dy2, dx3, -detright) == 0)) {
+      return detleft - detright;
+    }
+  }
+
+  for (i = 0; i < 6; i++) {
+    terms[2 * i] = products[i][0] * products[i][1];
+    terms[2 * i + 1] = tppl_fma(products[i][0], products[i][1], -terms[2 * i]);
+  }
+
+  // Adds the terms one by one to the expansion, whose components
+  // are kept in increasing order of magnitude, without zeros.
+  n = 0;
+  for (i = 0; i < 12; i++) {
+    q = terms[i];
+    m = 0;
+    for (j = 0; j < n; j++) {
+      TPPLTwoSum(q, expansion[j], q, h);
+      if (h != 0) {
+        expansion[m] = h;
+        m++;
+      }
+    }
+    if (q != 0) {
+      expansion[m] = q;
+      m++;
+    }
+    n = m;
+  }
+
+  // The largest component has the sign of the whole sum.
+  if (n == 0) {
+    return 0;
+  }
+  return expansion[n - 1];
+}
+
+// Returns a positive value if p1, p2, p3 are in counter-clockwise order,
+// a negative value if in clockwise order and 0 if they are collinear.
+// The determinant is computed in floating point first and only
+// recomputed exactly if the rounding error could have changed its sign.
+static inline tppl_float TPPLOrient2D(const TPPLPoint &p1, const TPPLPoint &p2, const TPPLPoint &p3) {
+  const tppl_float epsilon = std::numeric_limits<tppl_float>::epsilon() / 2;
+  const tppl_float errbound = (3 + 16 * epsilon) * epsilon;
+  tppl_float detleft, detright, det, detsum;
+
+  detleft = (p2.x - p1.x) * (p3.y - p1.y);
+  detright = (p2.y - p1.y) * (p3.x - p1.x);
+  det = detleft - detright;
+  detsum = fabs(detleft) + fabs(detright);
+  if ((det >= errbound * detsum) || (-det >= errbound * detsum)) {
+    return det;
+  }
+  return TPPLOrient2DExact(p1, p2, p3);
+}
+
+// Returns a positive value if p4 lies inside the circle through the
+// counter-clockwise triangle p1, p2, p3, a negative value if it lies
+// outside and 0 if it lies on the circle or if the floating-point
+// determinant is too close to 0 to be sure of its sign.
+static inline tppl_float TPPLInCircle(const TPPLPoint &p1, const TPPLPoint &p2, const TPPLPoint &p3, const TPPLPoint &p4) {
+  const tppl_float epsilon = std::numeric_limits<tppl_float>::epsilon() / 2;
+  const tppl_float errbound = (10 + 96 * epsilon) * epsilon;
+  tppl_float adx, ady, bdx, bdy, cdx, cdy;
+  tppl_float bdxcdy, cdxbdy, cdxady, adxcdy, adxbdy, bdxady;
+  tppl_float alift, blift, clift, det, permanent;
+
+  adx = p1.x - p4.x;
+  ady = p1.y - p4.y;
+  bdx = p2.x - p4.x;
+  bdy = p2.y - p4.y;
+  cdx = p3.x - p4.x;
+  cdy = p3.y - p4.y;
+
+  bdxcdy = bdx * cdy;
+  cdxbdy = cdx * bdy;
+  alift = adx * adx + ady * ady;
+  cdxady = cdx * ady;
+  adxcdy = adx * cdy;
+  blift = bdx * bdx + bdy * bdy;
+  adxbdy = adx * bdy;
+  bdxady = bdx * ady;
+  clift = cdx * cdx + cdy * cdy;
+
+  det = alift * (bdxcdy - cdxbdy) + blift * (cdxady - adxcdy) + clift * (adxbdy - bdxady);
+  permanent = (fabs(bdxcdy) + fabs(cdxbdy)) * alift + (fabs(cdxady) + fabs(adxcdy)) * blift +
+          (fabs(adxbdy) + fabs(bdxady)) * clift;
+  if ((det > errbound * permanent) || (-det > errbound * permanent)) {
+    return det;
+  }
+  return 0;
+}
+
+// Finds points that may lie inside the counter-clockwise triangle
+// p1, p2, p3, among points stored as separate x and y arrays. A point is
+// certainly outside if IsConvex is true for it and an edge already in
+// the floating-point filter of TPPLOrient2D. Any other point gets the
+// full test by the caller, so the answer is the same as testing every
+// point with IsInside.
+template <class T>
+class TPPLScalarTriangleFilter {
+  const TPPLPoint *a[3];
+  const TPPLPoint *b[3];
+
+  public:
+  TPPLScalarTriangleFilter(const TPPLPoint &p1, const TPPLPoint &p2, const TPPLPoint &p3) {
+    a[0] = &p1;
+    a[1] = &p2;
+    a[2] = &p3;
+    b[0] = &p2;
+    b[1] = &p3;
+    b[2] = &p1;
+  }
+
+  // Returns the index of the first point (x[i], y[i]), begin <= i < end,
+  // that is not certainly outside, or end if there is none.
+  long Find(const T *x, const T *y, long begin, long end) const {
+    const tppl_float epsilon = std::numeric_limits<tppl_float>::epsilon() / 2;
+    const tppl_float errbound = (3 + 16 * epsilon) * epsilon;
+    tppl_float detleft, detright, det;
+    long i;
+    int j;
+
+    for (i = begin; i < end; i++) {
+      for (j = 0; j < 3; j++) {
+        detleft = (x[i] - a[j]->x) * (b[j]->y - a[j]->y);
+        detright = (y[i] - a[j]->y) * (b[j]->x - a[j]->x);
+        det = detleft - detright;
+        if ((det > 0) && (det >= errbound * (fabs(detleft) + fabs(detright)))) {
+          break;
+        }
+      }
+      if (j == 3) {
+        return i;
+      }
+    }
+    return end;
+  }
+};
+
+template <class T>
+class TPPLTriangleFilter : public TPPLScalarTriangleFilter<T> {
+  public:
+  TPPLTriangleFilter(const TPPLPoint &p1, const TPPLPoint &p2, const TPPLPoint &p3) :
+          TPPLScalarTriangleFilter<T>(p1, p2, p3) {}
+};
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+// The same filter for double coordinates, testing two points at a time
+// with SSE2, or four with AVX if enabled at compile time.
+template <>
+class TPPLTriangleFilter<double> {
+  TPPLScalarTriangleFilter<double> scalar;
+  __m128d ax2[3], ay2[3], dx2[3], dy2[3];
+#ifdef __AVX__
+  __m256d ax4[3], ay4[3], dx4[3], dy4[3];
+#endif
+
+  public:
+  TPPLTriangleFilter(const TPPLPoint &p1, const TPPLPoint &p2, const TPPLPoint &p3) :
+          scalar(p1, p2, p3) {
+    const TPPLPoint *a[3] = { &p1, &p2, &p3 };
+    const TPPLPoint *b[3] = { &p2, &p3, &p1 };
+    int j;
+
+    for (j = 0; j < 3; j++) {
+      ax2[j] = _mm_set1_pd(a[j]->x);
+      ay2[j] = _mm_set1_pd(a[j]->y);
+      dx2[j] = _mm_set1_pd(b[j]->x - a[j]->x);
+      dy2[j] = _mm_set1_pd(b[j]->y - a[j]->y);
+#ifdef __AVX__
+      ax4[j] = _mm256_set1_pd(a[j]->x);
+      ay4[j] = _mm256_set1_pd(a[j]->y);
+      dx4[j] = _mm256_set1_pd(b[j]->x - a[j]->x);
+      dy4[j] = _mm256_set1_pd(b[j]->y - a[j]->y);
+#endif
+    }
+  }
+
+  long Find(const double *x, const double *y, long begin, long end) const {
+    const double epsilon = std::numeric_limits<double>::epsilon() / 2;
+    const double errbound = (3 + 16 * epsilon) * epsilon;
+    long i = begin;
+    int j, mask;
+
+#ifdef __AVX__
+    const __m256d bound4 = _mm256_set1_pd(errbound);
+    const __m256d sign4 = _mm256_set1_pd(-0.0);
+    const __m256d zero4 = _mm256_setzero_pd();
+    for (; i + 4 <= end; i += 4) {
+      __m256d px = _mm256_loadu_pd(x + i);
+      __m256d py = _mm256_loadu_pd(y + i);
+      __m256d outside = zero4;
+      for (j = 0; j < 3; j++) {
+        __m256d detleft = _mm256_mul_pd(_mm256_sub_pd(px, ax4[j]), dy4[j]);
+        __m256d detright = _mm256_mul_pd(_mm256_sub_pd(py, ay4[j]), dx4[j]);
+        __m256d det = _mm256_sub_pd(detleft, detright);
+        __m256d sum = _mm256_add_pd(_mm256_andnot_pd(sign4, detleft), _mm256_andnot_pd(sign4, detright));
+        outside = _mm256_or_pd(outside,
+                _mm256_and_pd(_mm256_cmp_pd(det, zero4, _CMP_GT_OQ),
+                        _mm256_cmp_pd(det, _mm256_mul_pd(bound4, sum), _CMP_GE_OQ)));
+      }
+      mask = _mm256_movemask_pd(outside);
+      if (mask != 15) {
+        for (j = 0; mask & (1 << j); j++) {
+        }
+        return i + j;
+      }
+    }
+#endif
+
+    const __m128d bound2 = _mm_set1_pd(errbound);
+    const __m128d sign2 = _mm_set1_pd(-0.0);
+    const __m128d zero2 = _mm_setzero_pd();
+    for (; i + 2 <= end; i += 2) {
+      __m128d px = _mm_loadu_pd(x + i);
+      __m128d py = _mm_loadu_pd(y + i);
+      __m128d outside = zero2;
+      for (j = 0; j < 3; j++) {
+        __m128d detleft = _mm_mul_pd(_mm_sub_pd(px, ax2[j]), dy2[j]);
+        __m128d detright = _mm_mul_pd(_mm_sub_pd(py, ay2[j]), dx2[j]);
+        __m128d det = _mm_sub_pd(detleft, detright);
+        __m128d sum = _mm_add_pd(_mm_andnot_pd(sign2, detleft), _mm_andnot_pd(sign2, detright));
+        outside = _mm_or_pd(outside,
+                _mm_and_pd(_mm_cmpgt_pd(det, zero2), _mm_cmpge_pd(det, _mm_mul_pd(bound2, sum))));
+      }
+      mask = _mm_movemask_pd(outside);
+      if (mask != 3) {
+        return (mask & 1) ? i + 1 : i;
+      }
+    }
+
+    return scalar.Find(x, y, i, end);
+  }
+};
+#endif
+
+// Releases the workspace memory allocated during its lifetime.
+class TPPLWorkspaceScope {
+  TPPLWorkspace *workspace;
+  size_t used;
+
+  public:
+  TPPLWorkspaceScope(TPPLWorkspace *workspace) :
+          workspace(workspace), used(workspace ? workspace->GetUsed() : 0) {}
+
+  ~TPPLWorkspaceScope() {
+    if (workspace) {
+      workspace->Release(used);
+    }
+  }
+};
+
 TPPLPoly::TPPLPoly() {
   hole = false;
   numpoints = 0;
   points = NULL;
+  attached = false;
 }
 
 TPPLPoly::~TPPLPoly() {
-  delete[] points;
+  if ((points != inlinepoints) && !attached) {
+    TPPLDeleteArray(points, numpoints);
+  }
 }
 
 void TPPLPoly::Clear() {
-  delete[] points;
+  if ((points != inlinepoints) && !attached) {
+    TPPLDeleteArray(points, numpoints);
+  }
   hole = false;
   numpoints = 0;
   points = NULL;
+  attached = false;
 }
 
 void TPPLPoly::Init(long numpoints) {
   Clear();
   this->numpoints = numpoints;
-  points = new TPPLPoint[numpoints];
+  if (numpoints <= TPPL_POLY_INLINE_POINTS) {
+    points = inlinepoints;
+  } else {
+    points = TPPLNewArray<TPPLPoint>(numpoints);
+  }
 }
 
-void TPPLPoly::Triangle(TPPLPoint &p1, TPPLPoint &p2, TPPLPoint &p3) {
+void TPPLPoly::Attach(TPPLPoint *points, long numpoints) {
+  Clear();
+  this->points = points;
+  this->numpoints = numpoints;
+  attached = true;
+}
+
+void TPPLPoly::Triangle(const TPPLPoint &p1, const TPPLPoint &p2, const TPPLPoint &p3) {
   Init(3);
   points[0] = p1;
   points[1] = p2;
   points[2] = p3;
 }
 
-TPPLPoly::TPPLPoly(const TPPLPoly &src) :
-        TPPLPoly() {
-  hole = src.hole;
-  numpoints = src.numpoints;
+TPPLPoly::TPPLPoly(const TPPLPoly &src) :
+        TPPLPoly() {
+  if (src.numpoints > 0) {
+    Init(src.numpoints);
+    memcpy(points, src.points, numpoints * sizeof(TPPLPoint));
+  }
+  hole = src.hole;
+}
+
+TPPLPoly &TPPLPoly::operator=(const TPPLPoly &src) {
+  if (this == &src) {
+    return *this;
+  }
+
+  Clear();
+  if (src.numpoints > 0) {
+    Init(src.numpoints);
+    memcpy(points, src.points, numpoints * sizeof(TPPLPoint));
+  }
+  hole = src.hole;
+
+  return *this;
+}
+
+TPPLPoly::TPPLPoly(TPPLPoly &&src) :
+        TPPLPoly() {
+  *this = std::move(src);
+}
+
+TPPLPoly &TPPLPoly::operator=(TPPLPoly &&src) {
+  if (this == &src) {
+    return *this;
+  }
+
+  Clear();
+  hole = src.hole;
+  numpoints = src.numpoints;
+  if (src.points == src.inlinepoints) {
+    points = inlinepoints;
+    memcpy(points, src.points, numpoints * sizeof(TPPLPoint));
+  } else {
+    points = src.points;
+    attached = src.attached;
+  }
+
+  src.hole = false;
+  src.numpoints = 0;
+  src.points = NULL;
+  src.attached = false;
+
+  return *this;
+}
+
+TPPLOrientation TPPLPoly::GetOrientation() const {
+  long i1, i2;
+  tppl_float area = 0;
+  for (i1 = 0; i1 < numpoints; i1++) {
+    i2 = i1 + 1;
+    if (i2 == numpoints) {
+      i2 = 0;
+    }
+    area += points[i1].x * points[i2].y - points[i1].y * points[i2].x;
+  }
+  if (area > 0) {
+    return TPPL_ORIENTATION_CCW;
+  }
+  if (area < 0) {
+    return TPPL_ORIENTATION_CW;
+  }
+  return TPPL_ORIENTATION_NONE;
+}
+
+void TPPLPoly::SetOrientation(TPPLOrientation orientation) {
+  TPPLOrientation polyorientation = GetOrientation();
+  if (polyorientation != TPPL_ORIENTATION_NONE && polyorientation != orientation) {
+    Invert();
+  }
+}
+
+void TPPLPoly::Invert() {
+  std::reverse(points, points + numpoints);
+}
+
+TPPLVisibilityGraph::TPPLVisibilityGraph() {
+  numvertices = 0;
+  rowsize = 0;
+  bits = NULL;
+}
+
+TPPLVisibilityGraph::~TPPLVisibilityGraph() {
+  Clear();
+}
+
+void TPPLVisibilityGraph::Clear() {
+  TPPLDeleteArray(bits, numvertices * rowsize);
+  numvertices = 0;
+  rowsize = 0;
+  bits = NULL;
+}
+
+void TPPLVisibilityGraph::Init(long numvertices) {
+  long i;
+
+  Clear();
+  this->numvertices = numvertices;
+  rowsize = (numvertices + 63) / 64;
+  bits = TPPLNewArray<uint64_t>(numvertices * rowsize);
+  for (i = 0; i < numvertices * rowsize; i++) {
+    bits[i] = 0;
+  }
+}
+
+TPPLVisibilityGraph::TPPLVisibilityGraph(const TPPLVisibilityGraph &src) :
+        TPPLVisibilityGraph() {
+  Init(src.numvertices);
+  memcpy(bits, src.bits, numvertices * rowsize * sizeof(uint64_t));
+}
+
+TPPLVisibilityGraph &TPPLVisibilityGraph::operator=(const TPPLVisibilityGraph &src) {
+  if (&src != this) {
+    Init(src.numvertices);
+    memcpy(bits, src.bits, numvertices * rowsize * sizeof(uint64_t));
+  }
+  return *this;
+}
+
+TPPLMonotonePieces::TPPLMonotonePieces() {
+  numpoints = 0;
+  numpieces = 0;
+  numindices = 0;
+  maxpoints = 0;
+  maxpieces = 0;
+  maxindices = 0;
+  points = NULL;
+  offsets = NULL;
+  indices = NULL;
+}
+
+TPPLMonotonePieces::~TPPLMonotonePieces() {
+  Clear();
+}
+
+void TPPLMonotonePieces::Clear() {
+  TPPLDeleteArray(points, maxpoints);
+  TPPLDeleteArray(offsets, maxpieces + 1);
+  TPPLDeleteArray(indices, maxindices);
+  numpoints = 0;
+  numpieces = 0;
+  numindices = 0;
+  maxpoints = 0;
+  maxpieces = 0;
+  maxindices = 0;
+  points = NULL;
+  offsets = NULL;
+  indices = NULL;
+}
+
+void TPPLMonotonePieces::Init(long numpoints, long numpieces, long numindices) {
+  if ((numpoints > maxpoints) || (numpieces > maxpieces) || (numindices > maxindices)) {
+    Clear();
+    maxpoints = numpoints;
+    maxpieces = numpieces;
+    maxindices = numindices;
+    points = TPPLNewArray<TPPLPoint>(maxpoints);
+    offsets = TPPLNewArray<long>(maxpieces + 1);
+    indices = TPPLNewArray<long>(maxindices);
+  }
+  this->numpoints = numpoints;
+  this->numpieces = numpieces;
+  this->numindices = numindices;
+  offsets[numpieces] = numindices;
+}
+
+TPPLMonotonePieces::TPPLMonotonePieces(const TPPLMonotonePieces &src) :
+        TPPLMonotonePieces() {
+  *this = src;
+}
+
+TPPLMonotonePieces &TPPLMonotonePieces::operator=(const TPPLMonotonePieces &src) {
+  if (&src != this) {
+    Init(src.numpoints, src.numpieces, src.numindices);
+    std::copy(src.points, src.points + numpoints, points);
+    memcpy(offsets, src.offsets, (numpieces + 1) * sizeof(long));
+    memcpy(indices, src.indices, numindices * sizeof(long));
+  }
+  return *this;
+}
+
+// Header of the blocks a workspace allocates while its memory is full.
+struct TPPLWorkspaceBlock {
+  char *next;
+  long units;
+};
+
+static const long TPPLWorkspaceBlockUnits =
+        (sizeof(TPPLWorkspaceBlock) + sizeof(std::max_align_t) - 1) / sizeof(std::max_align_t);
+
+TPPLWorkspace::TPPLWorkspace() {
+  memory = NULL;
+  size = 0;
+  used = 0;
+  blocks = NULL;
+  blocksize = 0;
+  maxblocksize = 0;
+}
+
+TPPLWorkspace::~TPPLWorkspace() {
+  Clear();
+}
+
+void TPPLWorkspace::FreeBlocks() {
+  TPPLWorkspaceBlock *block;
+
+  while (blocks) {
+    block = (TPPLWorkspaceBlock *)blocks;
+    blocks = block->next;
+    TPPLDeleteArray((std::max_align_t *)block, block->units);
+  }
+  blocksize = 0;
+}
+
+void TPPLWorkspace::Clear() {
+  FreeBlocks();
+  maxblocksize = 0;
+  TPPLDeleteArray((std::max_align_t *)memory, size / sizeof(std::max_align_t));
+  memory = NULL;
+  size = 0;
+  used = 0;
+  pieces.Clear();
+  outerpolys.Clear();
+  IndexArray().swap(gridentries);
+}
+
+void *TPPLWorkspace::Allocate(size_t bytes) {
+  TPPLWorkspaceBlock *block;
+  long units;
+
+  units = (bytes + sizeof(std::max_align_t) - 1) / sizeof(std::max_align_t);
+  bytes = units * sizeof(std::max_align_t);
+  if (!blocks && (used + bytes <= size)) {
+    used += bytes;
+    return memory + used - bytes;
+  }
+
+  // Doesn't fit, allocate a separate block until memory is released.
+  units += TPPLWorkspaceBlockUnits;
+  block = (TPPLWorkspaceBlock *)TPPLNewArray<std::max_align_t>(units);
+  block->next = blocks;
+  block->units = units;
+  blocks = (char *)block;
+  blocksize += units * sizeof(std::max_align_t);
+  maxblocksize = std::max(maxblocksize, blocksize);
+  return (std::max_align_t *)block + TPPLWorkspaceBlockUnits;
+}
+
+void TPPLWorkspace::Release(size_t used) {
+  TPPLWorkspaceBlock *block;
+  size_t newsize;
+
+  // Blocks are allocated after everything in memory, so they are
+  // released first, newest first.
+  while (blocks && (this->used + blocksize > used)) {
+    block = (TPPLWorkspaceBlock *)blocks;
+    blocks = block->next;
+    blocksize -= block->units * sizeof(std::max_align_t);
+    TPPLDeleteArray((std::max_align_t *)block, block->units);
+  }
+  if (!blocks) {
+    this->used = used;
+  }
+  if ((used > 0) || (maxblocksize == 0)) {
+    return;
+  }
+
+  // Grow memory to hold what the blocks held at most.
+  newsize = size + maxblocksize;
+  maxblocksize = 0;
+  TPPLDeleteArray((std::max_align_t *)memory, size / sizeof(std::max_align_t));
+  memory = (char *)TPPLNewArray<std::max_align_t>(newsize / sizeof(std::max_align_t));
+  size = newsize;
+}
+
+static const uint32_t TPPLPolyFileVersion = 1;
+static const uint32_t TPPLPolyFileByteOrder = 0x01020304;
+
+// Points in the binary format can be used in place if TPPLPoint
+// consists of the same two doubles.
+static const bool TPPLPolyFilePointsInPlace =
+        std::is_same<tppl_float, double>::value && (sizeof(TPPLPoint) == 2 * sizeof(double));
+
+TPPLPolyFile::TPPLPolyFile() {
+  data = NULL;
+  size = 0;
+  mapped = false;
+}
+
+TPPLPolyFile::~TPPLPolyFile() {
+  Close();
+}
+
+int TPPLPolyFile::Open(const char *filename) {
+  Close();
+
+#if defined(__unix__) || defined(__APPLE__)
+  struct stat st;
+  void *map;
+  int fd;
+
+  fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    return 0;
+  }
+  if ((fstat(fd, &st) != 0) || (st.st_size <= 0)) {
+    close(fd);
+    return 0;
+  }
+  map = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    return 0;
+  }
+  data = (char *)map;
+  size = (size_t)st.st_size;
+  mapped = true;
+  return 1;
+#else
+  FILE *fp;
+  long long filesize;
+
+  fp = fopen(filename, "rb");
+  if (!fp) {
+    return 0;
+  }
+#ifdef _WIN32
+  _fseeki64(fp, 0, SEEK_END);
+  filesize = _ftelli64(fp);
+  _fseeki64(fp, 0, SEEK_SET);
+#else
+  fseek(fp, 0, SEEK_END);
+  filesize = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+#endif
+  if (filesize <= 0) {
+    fclose(fp);
+    return 0;
+  }
+  // Allocated as 64-bit words for the alignment of the points.
+  size = (size_t)filesize;
+  data = (char *)TPPLNewArray<uint64_t>((size + 7) / 8);
+  if (fread(data, 1, size, fp) != size) {
+    fclose(fp);
+    Close();
+    return 0;
+  }
+  fclose(fp);
+  return 1;
+#endif
+}
+
+void TPPLPolyFile::Close() {
+  if (!data) {
+    return;
+  }
+#if defined(__unix__) || defined(__APPLE__)
+  if (mapped) {
+    munmap(data, size);
+  }
+#endif
+  if (!mapped) {
+    TPPLDeleteArray((uint64_t *)data, (size + 7) / 8);
+  }
+  data = NULL;
+  size = 0;
+  mapped = false;
+}
+
+int TPPLPolyFile::GetPolys(TPPLPolyList *polys) {
+  if (!data) {
+    return 0;
+  }
+  return Read(data, size, polys);
+}
+
+int TPPLPolyFile::Read(void *data, size_t size, TPPLPolyList *polys) {
+  TPPLPolyFileHeader *header = (TPPLPolyFileHeader *)data;
+  uint64_t *offsets;
+  uint8_t *holes;
+  double *coords;
+  uint64_t i, j, numpolys, numpoints, tablesize;
+  TPPLPoly poly;
+
+  if ((size < sizeof(TPPLPolyFileHeader)) || ((uintptr_t)data % 8 != 0)) {
+    return 0;
+  }
+  if ((memcmp(header->magic, "TPPL", 4) != 0) || (header->version != TPPLPolyFileVersion) ||
+          (header->byteorder != TPPLPolyFileByteOrder)) {
+    return 0;
+  }
+
+  // The counts are bounded by the size first, so that the
+  // sizes computed from them can't overflow.
+  size -= sizeof(TPPLPolyFileHeader);
+  numpolys = header->numpolys;
+  numpoints = header->numpoints;
+  if ((numpolys > size / 8) || (numpoints > size / 16)) {
+    return 0;
+  }
+  tablesize = 8 * (numpolys + 1) + (numpolys + 7) / 8 * 8;
+  if (tablesize + 16 * numpoints > size) {
+    return 0;
+  }
+  offsets = (uint64_t *)(header + 1);
+  holes = (uint8_t *)(offsets + numpolys + 1);
+  coords = (double *)((char *)offsets + tablesize);
+
+  if ((offsets[0] != 0) || (offsets[numpolys] != numpoints)) {
+    return 0;
+  }
+  for (i = 0; i < numpolys; i++) {
+    if (offsets[i + 1] < offsets[i]) {
+      return 0;
+    }
+  }
+
+  for (i = 0; i < numpolys; i++) {
+    if (TPPLPolyFilePointsInPlace) {
+      poly.Attach((TPPLPoint *)(coords + 2 * offsets[i]), (long)(offsets[i + 1] - offsets[i]));
+    } else {
+      poly.Init((long)(offsets[i + 1] - offsets[i]));
+      for (j = offsets[i]; j < offsets[i + 1]; j++) {
+        poly.GetPoint((long)(j - offsets[i])).x = (tppl_float)coords[2 * j];
+        poly.GetPoint((long)(j - offsets[i])).y = (tppl_float)coords[2 * j + 1];
+#if TPPL_POINT_ID
+        poly.GetPoint((long)(j - offsets[i])).id = 0;
+#endif
+      }
+    }
+    poly.SetHole(holes[i] != 0);
+    polys->push_back(std::move(poly));
+  }
+
+  return 1;
+}
+
+int TPPLPolyFile::Write(const char *filename, TPPLPolyList *polys) {
+  TPPLPolyFileHeader header;
+  TPPLPolyList::iterator iter;
+  FILE *fp;
+  uint64_t offset, i;
+  uint8_t hole;
+  double coords[512];
+  long j, k, n;
+  bool ok;
+
+  fp = fopen(filename, "wb");
+  if (!fp) {
+    return 0;
+  }
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, "TPPL", 4);
+  header.version = TPPLPolyFileVersion;
+  header.byteorder = TPPLPolyFileByteOrder;
+  for (iter = polys->begin(); iter != polys->end(); iter++) {
+    header.numpolys++;
+    header.numpoints += iter->GetNumPoints();
+  }
+  ok = (fwrite(&header, sizeof(header), 1, fp) == 1);
+
+  offset = 0;
+  for (iter = polys->begin(); iter != polys->end(); iter++) {
+    ok = ok && (fwrite(&offset, sizeof(offset), 1, fp) == 1);
+    offset += iter->GetNumPoints();
+  }
+  ok = ok && (fwrite(&offset, sizeof(offset), 1, fp) == 1);
+
+  for (iter = polys->begin(); iter != polys->end(); iter++) {
+    hole = iter->IsHole() ? 1 : 0;
+    ok = ok && (fwrite(&hole, 1, 1, fp) == 1);
+  }
+  hole = 0;
+  for (i = header.numpolys; i % 8 != 0; i++) {
+    ok = ok && (fwrite(&hole, 1, 1, fp) == 1);
+  }
+
+  for (iter = polys->begin(); iter != polys->end(); iter++) {
+    n = iter->GetNumPoints();
+    if (TPPLPolyFilePointsInPlace) {
+      ok = ok && (fwrite(iter->GetPoints(), sizeof(TPPLPoint), n, fp) == (size_t)n);
+      continue;
+    }
+    // Converted in chunks of 256 points.
+    for (j = 0; j < n; j += 256) {
+      for (k = j; (k < n) && (k < j + 256); k++) {
+        coords[2 * (k - j)] = (double)iter->GetPoint(k).x;
+        coords[2 * (k - j) + 1] = (double)iter->GetPoint(k).y;
+      }
+      ok = ok && (fwrite(coords, sizeof(double), 2 * (k - j), fp) == (size_t)(2 * (k - j)));
+    }
+  }
+
+  if (fclose(fp) != 0) {
+    ok = false;
+  }
+  return ok ? 1 : 0;
+}
+
+TPPLPartition::PartitionVertex::PartitionVertex() :
+        previous(NULL), next(NULL) {
+}
+
+TPPLPartition::VertexGrid::VertexGrid(PartitionVertex *vertices, long numvertices, TPPLWorkspace *workspace) :
+        vertices(vertices), numvertices(numvertices), workspace(workspace) {
+  long i, cell, numcells, numreflex;
+  tppl_float maxx, maxy, width, height, cellsize;
+
+  // Bounding box of the non-convex vertices, or of all
+  // vertices if the polygon is convex.
+  numreflex = 0;
+  for (i = 0; i < numvertices; i++) {
+    if (vertices[i].isConvex) {
+      continue;
+    }
+    if (numreflex == 0) {
+      minx = maxx = vertices[i].p.x;
+      miny = maxy = vertices[i].p.y;
+    }
+    minx = std::min(minx, vertices[i].p.x);
+    maxx = std::max(maxx, vertices[i].p.x);
+    miny = std::min(miny, vertices[i].p.y);
+    maxy = std::max(maxy, vertices[i].p.y);
+    numreflex++;
+  }
+  if (numreflex == 0) {
+    minx = maxx = vertices[0].p.x;
+    miny = maxy = vertices[0].p.y;
+    for (i = 1; i < numvertices; i++) {
+      minx = std::min(minx, vertices[i].p.x);
+      maxx = std::max(maxx, vertices[i].p.x);
+      miny = std::min(miny, vertices[i].p.y);
+      maxy = std::max(maxy, vertices[i].p.y);
+    }
+  }
+  width = maxx - minx;
+  height = maxy - miny;
+
+  // Aim for about two non-convex vertices per cell.
+  numcells = numreflex / 2 + 1;
+  if ((width > 0) && (height > 0)) {
+    cellsize = tppl_sqrt(width * height / numcells);
+  } else {
+    cellsize = (width + height) / numcells;
+  }
+  numcellsx = 1;
+  numcellsy = 1;
+  if (cellsize > 0) {
+    numcellsx = std::min((long)(width / cellsize) + 1, numcells);
+    numcellsy = std::min((long)(height / cellsize) + 1, numcells);
+  }
+  invcellwidth = (width > 0) ? numcellsx / width : 0;
+  invcellheight = (height > 0) ? numcellsy / height : 0;
+  numcells = numcellsx * numcellsy;
+
+  // Reserve room for all vertices in their cells,
+  // then add the non-convex ones.
+  cellstart = TPPLNewArray<long>(numcells, workspace);
+  cellcount = TPPLNewArray<long>(numcells, workspace);
+  cellvertices = TPPLNewArray<long>(numvertices, workspace);
+  cellx = TPPLNewArray<tppl_float>(numvertices, workspace);
+  celly = TPPLNewArray<tppl_float>(numvertices, workspace);
+  positions = TPPLNewArray<long>(numvertices, workspace);
+  for (cell = 0; cell < numcells; cell++) {
+    cellcount[cell] = 0;
+  }
+  for (i = 0; i < numvertices; i++) {
+    cellcount[GetCellY(vertices[i].p.y) * numcellsx + GetCellX(vertices[i].p.x)]++;
+  }
+  cellstart[0] = 0;
+  for (cell = 1; cell < numcells; cell++) {
+    cellstart[cell] = cellstart[cell - 1] + cellcount[cell - 1];
+    cellcount[cell - 1] = 0;
+  }
+  cellcount[numcells - 1] = 0;
+  for (i = 0; i < numvertices; i++) {
+    positions[i] = -1;
+    if (!vertices[i].isConvex) {
+      Insert(i);
+    }
+  }
+}
+
+TPPLPartition::VertexGrid::~VertexGrid() {
+  TPPLDeleteArray(cellstart, numcellsx * numcellsy, workspace);
+  TPPLDeleteArray(cellcount, numcellsx * numcellsy, workspace);
+  TPPLDeleteArray(cellvertices, numvertices, workspace);
+  TPPLDeleteArray(cellx, numvertices, workspace);
+  TPPLDeleteArray(celly, numvertices, workspace);
+  TPPLDeleteArray(positions, numvertices, workspace);
+}
+
+long TPPLPartition::VertexGrid::GetCellX(tppl_float x) {
+  long cellx = (long)((x - minx) * invcellwidth);
+  return std::max(0L, std::min(cellx, numcellsx - 1));
+}
+
+long TPPLPartition::VertexGrid::GetCellY(tppl_float y) {
+  long celly = (long)((y - miny) * invcellheight);
+  return std::max(0L, std::min(celly, numcellsy - 1));
+}
+
+void TPPLPartition::VertexGrid::Insert(long index) {
+  long cell;
 
-  if (numpoints > 0) {
-    points = new TPPLPoint[numpoints];
-    memcpy(points, src.points, numpoints * sizeof(TPPLPoint));
+  if (positions[index] >= 0) {
+    return;
   }
+  cell = GetCellY(vertices[index].p.y) * numcellsx + GetCellX(vertices[index].p.x);
+  positions[index] = cellstart[cell] + cellcount[cell];
+  cellvertices[positions[index]] = index;
+  cellx[positions[index]] = vertices[index].p.x;
+  celly[positions[index]] = vertices[index].p.y;
+  cellcount[cell]++;
 }
 
-TPPLPoly &TPPLPoly::operator=(const TPPLPoly &src) {
-  Clear();
-  hole = src.hole;
-  numpoints = src.numpoints;
+void TPPLPartition::VertexGrid::Remove(long index) {
+  long cell, last;
 
-  if (numpoints > 0) {
-    points = new TPPLPoint[numpoints];
-    memcpy(points, src.points, numpoints * sizeof(TPPLPoint));
+  if (positions[index] < 0) {
+    return;
   }
+  cell = GetCellY(vertices[index].p.y) * numcellsx + GetCellX(vertices[index].p.x);
+  cellcount[cell]--;
+  last = cellvertices[cellstart[cell] + cellcount[cell]];
+  cellvertices[positions[index]] = last;
+  cellx[positions[index]] = cellx[cellstart[cell] + cellcount[cell]];
+  celly[positions[index]] = celly[cellstart[cell] + cellcount[cell]];
+  positions[last] = positions[index];
+  positions[index] = -1;
+}
 
-  return *this;
+TPPLPartition::TriangleSink::TriangleSink(TPPLPolyList *triangles) :
+        points(NULL), remap(NULL), triangles(triangles), indices(NULL), numtriangles(0) {
 }
 
-TPPLOrientation TPPLPoly::GetOrientation() const {
-  long i1, i2;
-  tppl_float area = 0;
-  for (i1 = 0; i1 < numpoints; i1++) {
-    i2 = i1 + 1;
-    if (i2 == numpoints) {
-      i2 = 0;
+TPPLPartition::TriangleSink::TriangleSink(uint32_t *indices) :
+        points(NULL), remap(NULL), triangles(NULL), indices(indices), numtriangles(0) {
+}
+
+void TPPLPartition::TriangleSink::Add(long index1, long index2, long index3) {
+  if (triangles) {
+    triangles->emplace_back();
+    triangles->back().Triangle(points[index1], points[index2], points[index3]);
+  } else {
+    uint32_t *triangle = indices + 3 * numtriangles;
+    if (remap) {
+      triangle[0] = (uint32_t)remap[index1];
+      triangle[1] = (uint32_t)remap[index2];
+      triangle[2] = (uint32_t)remap[index3];
+    } else {
+      triangle[0] = (uint32_t)index1;
+      triangle[1] = (uint32_t)index2;
+      triangle[2] = (uint32_t)index3;
     }
-    area += points[i1].x * points[i2].y - points[i1].y * points[i2].x;
-  }
-  if (area > 0) {
-    return TPPL_ORIENTATION_CCW;
-  }
-  if (area < 0) {
-    return TPPL_ORIENTATION_CW;
   }
-  return TPPL_ORIENTATION_NONE;
+  numtriangles++;
 }
 
-void TPPLPoly::SetOrientation(TPPLOrientation orientation) {
-  TPPLOrientation polyorientation = GetOrientation();
-  if (polyorientation != TPPL_ORIENTATION_NONE && polyorientation != orientation) {
-    Invert();
+void TPPLStats::Clear() {
+  numconvextests = 0;
+  numintersecttests = 0;
+  numinsidetests = 0;
+  numvertexupdates = 0;
+  numeartests = 0;
+  numsweepoperations = 0;
+  numdpstates = 0;
+  numholesbridged = 0;
+  numflips = 0;
+  numbytesallocated = 0;
+  removeholestime = 0;
+  visibilitytime = 0;
+  dptime = 0;
+  earclippingtime = 0;
+  mergetime = 0;
+  sweeptime = 0;
+  monotonetime = 0;
+  fliptime = 0;
+}
+
+void TPPLStats::Add(const TPPLStats &stats) {
+  numconvextests += stats.numconvextests;
+  numintersecttests += stats.numintersecttests;
+  numinsidetests += stats.numinsidetests;
+  numvertexupdates += stats.numvertexupdates;
+  numeartests += stats.numeartests;
+  numsweepoperations += stats.numsweepoperations;
+  numdpstates += stats.numdpstates;
+  numholesbridged += stats.numholesbridged;
+  numflips += stats.numflips;
+  numbytesallocated += stats.numbytesallocated;
+  removeholestime += stats.removeholestime;
+  visibilitytime += stats.visibilitytime;
+  dptime += stats.dptime;
+  earclippingtime += stats.earclippingtime;
+  mergetime += stats.mergetime;
+  sweeptime += stats.sweeptime;
+  monotonetime += stats.monotonetime;
+  fliptime += stats.fliptime;
+}
+
+TPPLPartition::TPPLPartition() {
+  earpolicy = TPPL_EARPOLICY_MOST_EXTRUDED;
+  numthreads = 1;
+  memorylimit = 0;
+  workspace = NULL;
+  stats = NULL;
+}
+
+// Returns the number of threads to use for the given number of
+// operations, so that each thread gets a fair amount of them.
+int TPPLPartition::GetThreadCount(long work) {
+  long threads = numthreads;
+  if (threads <= 0) {
+    threads = std::max(1L, (long)std::thread::hardware_concurrency());
   }
+  return (int)std::max(1L, std::min(threads, work / 1000000));
 }
 
-void TPPLPoly::Invert() {
-  std::reverse(points, points + numpoints);
+long TPPLPartition::GetNumTriangles(TPPLPoly *poly) {
+  return poly->GetNumPoints() - 2;
 }
 
-TPPLPartition::PartitionVertex::PartitionVertex() :
-        previous(NULL), next(NULL) {
+long TPPLPartition::GetNumTriangles(TPPLPolyList *inpolys) {
+  TPPLPolyList::iterator iter;
+  long numtriangles = 0;
+
+  for (iter = inpolys->begin(); iter != inpolys->end(); iter++) {
+    if (iter->IsHole()) {
+      numtriangles += iter->GetNumPoints() + 2;
+    } else {
+      numtriangles += iter->GetNumPoints() - 2;
+    }
+  }
+  return numtriangles;
 }
 
 TPPLPoint TPPLPartition::Normalize(const TPPLPoint &p) {
@@ -135,8 +1377,26 @@ tppl_float TPPLPartition::Distance(const TPPLPoint &p1, const TPPLPoint &p2) {
   return (tppl_sqrt(dx * dx + dy * dy));
 }
 
+// Returns cos(a) * |cos(a)|, a being the angle between p1 and p2.
+// Orders angles like the cosine but doesn't need a square root. It is
+// rounded differently from the cosine of normalized vectors, so nearly
+// equal angles may be ordered differently.
+tppl_float TPPLPartition::SignedSquaredCosine(const TPPLPoint &p1, const TPPLPoint &p2) {
+  tppl_float dot, lengths;
+  dot = p1.x * p2.x + p1.y * p2.y;
+  lengths = (p1.x * p1.x + p1.y * p1.y) * (p2.x * p2.x + p2.y * p2.y);
+  if (lengths == 0) {
+    return 0;
+  }
+  if (dot < 0) {
+    return -dot * dot / lengths;
+  }
+  return dot * dot / lengths;
+}
+
 // Checks if two lines intersect.
 int TPPLPartition::Intersects(TPPLPoint &p11, TPPLPoint &p12, TPPLPoint &p21, TPPLPoint &p22) {
+  TPPL_STATS_ADD(numintersecttests, 1);
   if ((p11.x == p21.x) && (p11.y == p21.y)) {
     return 0;
   }
@@ -150,29 +1410,17 @@ int TPPLPartition::Intersects(TPPLPoint &p11, TPPLPoint &p12, TPPLPoint &p21, TP
     return 0;
   }
 
-  TPPLPoint v1ort, v2ort, v;
-  tppl_float dot11, dot12, dot21, dot22;
+  tppl_float side11, side12, side21, side22;
 
-  v1ort.x = p12.y - p11.y;
-  v1ort.y = p11.x - p12.x;
+  side21 = TPPLOrient2D(p11, p12, p21);
+  side22 = TPPLOrient2D(p11, p12, p22);
+  side11 = TPPLOrient2D(p21, p22, p11);
+  side12 = TPPLOrient2D(p21, p22, p12);
 
-  v2ort.x = p22.y - p21.y;
-  v2ort.y = p21.x - p22.x;
-
-  v = p21 - p11;
-  dot21 = v.x * v1ort.x + v.y * v1ort.y;
-  v = p22 - p11;
-  dot22 = v.x * v1ort.x + v.y * v1ort.y;
-
-  v = p11 - p21;
-  dot11 = v.x * v2ort.x + v.y * v2ort.y;
-  v = p12 - p21;
-  dot12 = v.x * v2ort.x + v.y * v2ort.y;
-
-  if (dot11 * dot12 > 0) {
+  if (((side11 > 0) && (side12 > 0)) || ((side11 < 0) && (side12 < 0))) {
     return 0;
   }
-  if (dot21 * dot22 > 0) {
+  if (((side21 > 0) && (side22 > 0)) || ((side21 < 0) && (side22 < 0))) {
     return 0;
   }
 
@@ -181,144 +1429,553 @@ int TPPLPartition::Intersects(TPPLPoint &p11, TPPLPoint &p12, TPPLPoint &p21, TP
 
 // Removes holes from inpolys by merging them with non-holes.
 int TPPLPartition::RemoveHoles(TPPLPolyList *inpolys, TPPLPolyList *outpolys) {
-  TPPLPolyList polys;
-  TPPLPolyList::iterator holeiter, polyiter, iter, iter2;
-  long i, i2, holepointindex, polypointindex;
-  TPPLPoint holepoint, polypoint, bestpolypoint;
-  TPPLPoint linep1, linep2;
-  tppl_float v1dist, v2dist;
+  TPPLMonotonePieces pieces;
   TPPLPoly newpoly;
-  bool hasholes;
-  bool pointvisible;
-  bool pointfound;
+  long i, j;
 
-  // Check for the trivial case of no holes.
-  hasholes = false;
-  for (iter = inpolys->begin(); iter != inpolys->end(); iter++) {
-    if (iter->IsHole()) {
-      hasholes = true;
-      break;
+  if (!RemoveHoles(inpolys, &pieces)) {
+    return 0;
+  }
+  for (i = 0; i < pieces.GetNumPieces(); i++) {
+    newpoly.Init(pieces.GetNumVertices(i));
+    for (j = 0; j < pieces.GetNumVertices(i); j++) {
+      newpoly[j] = pieces.GetPoints()[pieces.GetIndices()[pieces.GetOffsets()[i] + j]];
     }
+    outpolys->push_back(std::move(newpoly));
   }
-  if (!hasholes) {
-    for (iter = inpolys->begin(); iter != inpolys->end(); iter++) {
-      outpolys->push_back(*iter);
+  return 1;
+}
+
+TPPLPartition::EdgeGrid::EdgeGrid(TPPLPolyList *polys, long maxedges, TPPLWorkspace *workspace) :
+        entries(workspace ? workspace->gridentries : localentries), workspace(workspace) {
+  TPPLPolyList::iterator iter;
+  long i, numvertices;
+  tppl_float x1, y1, x2, y2;
+
+  x1 = x2 = 0;
+  y1 = y2 = 0;
+  numvertices = 0;
+  for (iter = polys->begin(); iter != polys->end(); iter++) {
+    for (i = 0; i < iter->GetNumPoints(); i++) {
+      if (numvertices == 0) {
+        x1 = x2 = iter->GetPoint(i).x;
+        y1 = y2 = iter->GetPoint(i).y;
+      }
+      x1 = std::min(x1, iter->GetPoint(i).x);
+      x2 = std::max(x2, iter->GetPoint(i).x);
+      y1 = std::min(y1, iter->GetPoint(i).y);
+      y2 = std::max(y2, iter->GetPoint(i).y);
+      numvertices++;
+    }
+  }
+  Init(x1, y1, x2, y2, numvertices, maxedges);
+}
+
+TPPLPartition::EdgeGrid::EdgeGrid(TPPLPoly *poly, long maxedges, TPPLWorkspace *workspace) :
+        entries(workspace ? workspace->gridentries : localentries), workspace(workspace) {
+  long i;
+  tppl_float x1, y1, x2, y2;
+
+  x1 = x2 = 0;
+  y1 = y2 = 0;
+  for (i = 0; i < poly->GetNumPoints(); i++) {
+    if (i == 0) {
+      x1 = x2 = poly->GetPoint(i).x;
+      y1 = y2 = poly->GetPoint(i).y;
+    }
+    x1 = std::min(x1, poly->GetPoint(i).x);
+    x2 = std::max(x2, poly->GetPoint(i).x);
+    y1 = std::min(y1, poly->GetPoint(i).y);
+    y2 = std::max(y2, poly->GetPoint(i).y);
+  }
+  Init(x1, y1, x2, y2, poly->GetNumPoints(), maxedges);
+}
+
+void TPPLPartition::EdgeGrid::Init(tppl_float minx, tppl_float miny, tppl_float maxx, tppl_float maxy, long numvertices, long maxedges) {
+  long cell, numcells;
+  tppl_float width, height, cellsize;
+
+  this->minx = minx;
+  this->miny = miny;
+  this->maxedges = maxedges;
+  width = maxx - minx;
+  height = maxy - miny;
+
+  // Aim for about two vertices per cell.
+  numcells = numvertices / 2 + 1;
+  if ((width > 0) && (height > 0)) {
+    cellsize = tppl_sqrt(width * height / numcells);
+  } else {
+    cellsize = (width + height) / numcells;
+  }
+  numcellsx = 1;
+  numcellsy = 1;
+  if (cellsize > 0) {
+    numcellsx = std::min((long)(width / cellsize) + 1, numcells);
+    numcellsy = std::min((long)(height / cellsize) + 1, numcells);
+  }
+  cellwidth = width / numcellsx;
+  cellheight = height / numcellsy;
+  invcellwidth = (width > 0) ? numcellsx / width : 0;
+  invcellheight = (height > 0) ? numcellsy / height : 0;
+  numcells = numcellsx * numcellsy;
+
+  vertexlists = TPPLNewArray<long>(numcells, workspace);
+  edgelists = TPPLNewArray<long>(numcells, workspace);
+  for (cell = 0; cell < numcells; cell++) {
+    vertexlists[cell] = -1;
+    edgelists[cell] = -1;
+  }
+  edgepoints = TPPLNewArray<TPPLPoint>(2 * maxedges, workspace);
+  edgestamps = TPPLNewArray<long>(maxedges, workspace);
+  entries.clear();
+  numedges = 0;
+  stamp = 0;
+}
+
+TPPLPartition::EdgeGrid::~EdgeGrid() {
+  TPPLDeleteArray(vertexlists, numcellsx * numcellsy, workspace);
+  TPPLDeleteArray(edgelists, numcellsx * numcellsy, workspace);
+  TPPLDeleteArray(edgepoints, 2 * maxedges, workspace);
+  TPPLDeleteArray(edgestamps, maxedges, workspace);
+}
+
+long TPPLPartition::EdgeGrid::GetCellX(tppl_float x) {
+  long cellx = (long)((x - minx) * invcellwidth);
+  return std::max(0L, std::min(cellx, numcellsx - 1));
+}
+
+long TPPLPartition::EdgeGrid::GetCellY(tppl_float y) {
+  long celly = (long)((y - miny) * invcellheight);
+  return std::max(0L, std::min(celly, numcellsy - 1));
+}
+
+void TPPLPartition::EdgeGrid::AddVertex(long index, const TPPLPoint &p) {
+  long cell = GetCellY(p.y) * numcellsx + GetCellX(p.x);
+  entries.push_back(index);
+  entries.push_back(vertexlists[cell]);
+  vertexlists[cell] = (long)entries.size() - 2;
+}
+
+void TPPLPartition::EdgeGrid::AddEdge(const TPPLPoint &p1, const TPPLPoint &p2) {
+  long cellx, celly, cellx1, cellx2, celly1, celly2, cell;
+
+  edgepoints[2 * numedges] = p1;
+  edgepoints[2 * numedges + 1] = p2;
+  edgestamps[numedges] = 0;
+
+  // The edge goes into all cells overlapping its bounding box.
+  cellx1 = GetCellX(std::min(p1.x, p2.x));
+  cellx2 = GetCellX(std::max(p1.x, p2.x));
+  celly1 = GetCellY(std::min(p1.y, p2.y));
+  celly2 = GetCellY(std::max(p1.y, p2.y));
+  for (celly = celly1; celly <= celly2; celly++) {
+    for (cellx = cellx1; cellx <= cellx2; cellx++) {
+      cell = celly * numcellsx + cellx;
+      entries.push_back(numedges);
+      entries.push_back(edgelists[cell]);
+      edgelists[cell] = (long)entries.size() - 2;
+    }
+  }
+  numedges++;
+}
+
+// Sorts in the descending order of distance, so that a heap
+// gives the closest vertex first.
+bool TPPLPartition::RingVertexSorter::operator()(long index1, long index2) {
+  return vertices[index1].distance > vertices[index2].distance;
+}
+
+// Checks if the line p1-p2 intersects any edge in a grid cell.
+int TPPLPartition::Intersects(EdgeGrid *grid, long cell, TPPLPoint &p1, TPPLPoint &p2) {
+  long entry, edge;
+
+  for (entry = grid->edgelists[cell]; entry >= 0; entry = grid->entries[entry + 1]) {
+    edge = grid->entries[entry];
+    if (grid->edgestamps[edge] == grid->stamp) {
+      continue;
+    }
+    grid->edgestamps[edge] = grid->stamp;
+    if (Intersects(p1, p2, grid->edgepoints[2 * edge], grid->edgepoints[2 * edge + 1])) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// Checks if the line p1-p2 intersects any edge in the grid.
+int TPPLPartition::Intersects(EdgeGrid *grid, TPPLPoint &p1, TPPLPoint &p2) {
+  long i, j, numcolumns, column, first, last, cell1, cell2;
+  tppl_float slope, a1, a2, b1, b2;
+  bool steep;
+
+  grid->stamp++;
+
+  // Intersects() also reports edges collinear with the line that don't
+  // overlap it, so the cells along the whole line through p1 and p2
+  // have to be checked. The columns (or rows, for steep lines) between
+  // p1 and p2 are checked first, as that is where the edges hiding p2
+  // from p1 usually are.
+  steep = fabs(p2.y - p1.y) > fabs(p2.x - p1.x);
+  if (steep) {
+    slope = (p2.x - p1.x) / (p2.y - p1.y);
+    numcolumns = grid->numcellsy;
+    first = grid->GetCellY(std::min(p1.y, p2.y));
+    last = grid->GetCellY(std::max(p1.y, p2.y));
+  } else {
+    slope = (p2.y - p1.y) / (p2.x - p1.x);
+    numcolumns = grid->numcellsx;
+    first = grid->GetCellX(std::min(p1.x, p2.x));
+    last = grid->GetCellX(std::max(p1.x, p2.x));
+  }
+  for (i = 0; i < numcolumns; i++) {
+    column = (first + i) % numcolumns;
+    if ((i > last - first) && (column >= first) && (column <= last)) {
+      continue;
+    }
+    if (steep) {
+      a1 = grid->miny + column * grid->cellheight;
+      a2 = a1 + grid->cellheight;
+      b1 = p1.x + (a1 - p1.y) * slope;
+      b2 = p1.x + (a2 - p1.y) * slope;
+      cell1 = grid->GetCellX(std::min(b1, b2)) - 1;
+      cell2 = grid->GetCellX(std::max(b1, b2)) + 1;
+      cell1 = std::max(cell1, 0L);
+      cell2 = std::min(cell2, grid->numcellsx - 1);
+      for (j = cell1; j <= cell2; j++) {
+        if (Intersects(grid, column * grid->numcellsx + j, p1, p2)) {
+          return 1;
+        }
+      }
+    } else {
+      a1 = grid->minx + column * grid->cellwidth;
+      a2 = a1 + grid->cellwidth;
+      b1 = p1.y + (a1 - p1.x) * slope;
+      b2 = p1.y + (a2 - p1.x) * slope;
+      cell1 = grid->GetCellY(std::min(b1, b2)) - 1;
+      cell2 = grid->GetCellY(std::max(b1, b2)) + 1;
+      cell1 = std::max(cell1, 0L);
+      cell2 = std::min(cell2, grid->numcellsy - 1);
+      for (j = cell1; j <= cell2; j++) {
+        if (Intersects(grid, j * grid->numcellsx + column, p1, p2)) {
+          return 1;
+        }
+      }
     }
-    return 1;
   }
+  return 0;
+}
 
-  polys = *inpolys;
+// Checks if v1 comes before v2 when going through the outer polygons
+// in list order, and through the vertices of each polygon from the first.
+bool TPPLPartition::IsBefore(RingVertex *v1, RingVertex *v2, RingVertex **ringheads, long *ringorder) {
+  RingVertex *p1, *p2, *head;
 
+  if (v1->ring != v2->ring) {
+    return ringorder[v1->ring] < ringorder[v2->ring];
+  }
+  head = ringheads[v1->ring];
+  if (v1 == head) {
+    return true;
+  }
+  if (v2 == head) {
+    return false;
+  }
+  // Walk from both vertices at once, until one of them reaches
+  // the other vertex or the end of the ring.
+  p1 = v1;
+  p2 = v2;
   while (1) {
-    // Find the hole point with the largest x.
-    hasholes = false;
-    for (iter = polys.begin(); iter != polys.end(); iter++) {
+    p1 = p1->next;
+    if (p1 == v2) {
+      return true;
+    }
+    if (p1 == head) {
+      return false;
+    }
+    p2 = p2->next;
+    if (p2 == v1) {
+      return false;
+    }
+    if (p2 == head) {
+      return true;
+    }
+  }
+}
+
+int TPPLPartition::RemoveHoles(TPPLPolyList *inpolys, TPPLMonotonePieces *outpolys) {
+  TPPLWorkspaceScope scope(workspace);
+  TPPL_STATS_SCOPE();
+  TPPL_STATS_TIMER(timer, removeholestime);
+  TPPLPolyList::iterator iter;
+  long i, j, k, numvertices, numpolys, numholes, numrings, numringvertices, ring, nextorder;
+  long numcandidates;
+  long cellx, celly, cellx0, celly0, radius, maxradius, entry;
+  RingVertex *vertices = NULL;
+  RingVertex **ringheads = NULL;
+  RingVertex *v = NULL, *holevertex = NULL, *polyvertex = NULL;
+  RingVertex *holecopy = NULL, *polycopy = NULL, *next = NULL;
+  long *ringorder = NULL;
+  long *ringsizes = NULL;
+  long *holepointindices = NULL;
+  tppl_float *holemaxx = NULL;
+  tppl_float cellsize, bound;
+  long *holes = NULL, *rings = NULL, *candidates = NULL;
+  long *offsets = NULL, *indices = NULL;
+  TPPLPoint holepoint;
+  bool pointfound;
+
+  // Number the vertices of all polygons. Every outer polygon becomes a
+  // piece, and every hole with vertices adds its vertices and the copies
+  // of the two diagonal endpoints to one of them.
+  numvertices = 0;
+  numpolys = 0;
+  numrings = 0;
+  numholes = 0;
+  for (iter = inpolys->begin(); iter != inpolys->end(); iter++) {
+    numvertices += iter->GetNumPoints();
+    numpolys++;
+    if (!iter->IsHole()) {
+      numrings++;
+    } else if (iter->GetNumPoints() > 0) {
+      numholes++;
+    }
+  }
+  numringvertices = numvertices + 2 * numholes;
+  outpolys->Init(numvertices, numrings, numringvertices);
+  offsets = outpolys->GetOffsets();
+  indices = outpolys->GetIndices();
+  i = 0;
+  for (iter = inpolys->begin(); iter != inpolys->end(); iter++) {
+    for (j = 0; j < iter->GetNumPoints(); j++) {
+      outpolys->GetPoints()[i++] = iter->GetPoint(j);
+    }
+  }
+
+  // Check for the trivial case of no holes.
+  if (numholes == 0) {
+    i = 0;
+    ring = 0;
+    for (iter = inpolys->begin(); iter != inpolys->end(); iter++) {
       if (!iter->IsHole()) {
-        continue;
+        offsets[ring++] = i;
       }
-
-      if (!hasholes) {
-        hasholes = true;
-        holeiter = iter;
-        holepointindex = 0;
+      for (j = 0; j < iter->GetNumPoints(); j++) {
+        indices[i] = i;
+        i++;
       }
+    }
+    return 1;
+  }
 
-      for (i = 0; i < iter->GetNumPoints(); i++) {
-        if (iter->GetPoint(i).x > holeiter->GetPoint(holepointindex).x) {
-          holeiter = iter;
-          holepointindex = i;
-        }
+  // Link the vertices of every polygon into a ring.
+  vertices = TPPLNewArray<RingVertex>(numringvertices, workspace);
+  ringheads = TPPLNewArray<RingVertex *>(numpolys, workspace);
+  ringorder = TPPLNewArray<long>(numpolys, workspace);
+  ringsizes = TPPLNewArray<long>(numpolys, workspace);
+  holepointindices = TPPLNewArray<long>(numpolys, workspace);
+  holemaxx = TPPLNewArray<tppl_float>(numpolys, workspace);
+  holes = TPPLNewArray<long>(numholes, workspace);
+  rings = TPPLNewArray<long>(numrings, workspace);
+  // Every vertex is in one grid cell, so it is a candidate at most once
+  // per hole.
+  candidates = TPPLNewArray<long>(numringvertices, workspace);
+
+  EdgeGrid grid(inpolys, numringvertices, workspace);
+
+  j = 0;
+  ring = 0;
+  numrings = 0;
+  numholes = 0;
+  for (iter = inpolys->begin(); iter != inpolys->end(); iter++, ring++) {
+    ringheads[ring] = &(vertices[j]);
+    ringorder[ring] = ring;
+    ringsizes[ring] = iter->GetNumPoints();
+    holepointindices[ring] = 0;
+    holemaxx[ring] = -std::numeric_limits<tppl_float>::max();
+    for (i = 0; i < iter->GetNumPoints(); i++) {
+      v = &(vertices[j + i]);
+      v->p = iter->GetPoint(i);
+      v->index = j + i;
+      v->ring = ring;
+      v->previous = &(vertices[j + (i + iter->GetNumPoints() - 1) % iter->GetNumPoints()]);
+      v->next = &(vertices[j + (i + 1) % iter->GetNumPoints()]);
+      if (!iter->IsHole()) {
+        grid.AddVertex(j + i, v->p);
+        grid.AddEdge(v->p, iter->GetPoint((i + 1) % iter->GetNumPoints()));
+      } else if (v->p.x > iter->GetPoint(holepointindices[ring]).x) {
+        holepointindices[ring] = i;
       }
     }
-    if (!hasholes) {
-      break;
+    if (!iter->IsHole()) {
+      rings[numrings++] = ring;
+    } else if (iter->GetNumPoints() > 0) {
+      holes[numholes++] = ring;
+      holemaxx[ring] = iter->GetPoint(holepointindices[ring]).x;
+    }
+    j += iter->GetNumPoints();
+  }
+
+  // Holes are removed from the one with the largest x to the one with
+  // the smallest, ties in the list order.
+  std::sort(holes, holes + numholes, [holemaxx](long hole1, long hole2) {
+    if (holemaxx[hole1] != holemaxx[hole2]) {
+      return holemaxx[hole1] > holemaxx[hole2];
     }
-    holepoint = holeiter->GetPoint(holepointindex);
+    return hole1 < hole2;
+  });
+
+  cellsize = std::numeric_limits<tppl_float>::max();
+  if (grid.numcellsx > 1) {
+    cellsize = grid.cellwidth;
+  }
+  if (grid.numcellsy > 1) {
+    cellsize = std::min(cellsize, grid.cellheight);
+  }
 
+  nextorder = numpolys;
+  for (j = 0; j < numholes; j++) {
+    holevertex = ringheads[holes[j]] + holepointindices[holes[j]];
+    holepoint = holevertex->p;
+
+    // Search for the closest visible vertex in rings of cells of growing
+    // radius around the hole vertex. Only cells to the right of it can
+    // hold vertices with a larger x.
+    // A vertex closer than the bound can't be in a cell that is not
+    // yet searched, so is the closest one as soon as it is visible.
+    // Ties are resolved in favor of the last vertex in list order.
     pointfound = false;
-    for (iter = polys.begin(); iter != polys.end(); iter++) {
-      if (iter->IsHole()) {
-        continue;
-      }
-      for (i = 0; i < iter->GetNumPoints(); i++) {
-        if (iter->GetPoint(i).x <= holepoint.x) {
-          continue;
-        }
-        if (!InCone(iter->GetPoint((i + iter->GetNumPoints() - 1) % (iter->GetNumPoints())),
-                    iter->GetPoint(i),
-                    iter->GetPoint((i + 1) % (iter->GetNumPoints())),
-                    holepoint)) {
-          continue;
-        }
-        polypoint = iter->GetPoint(i);
-        if (pointfound) {
-          v1dist = Distance(holepoint, polypoint);
-          v2dist = Distance(holepoint, bestpolypoint);
-          if (v2dist < v1dist) {
+    numcandidates = 0;
+    cellx0 = grid.GetCellX(holepoint.x);
+    celly0 = grid.GetCellY(holepoint.y);
+    maxradius = std::max(grid.numcellsx - 1 - cellx0, std::max(celly0, grid.numcellsy - 1 - celly0));
+    for (radius = 0; (radius <= maxradius) && !pointfound; radius++) {
+      for (celly = std::max(celly0 - radius, 0L); celly <= std::min(celly0 + radius, grid.numcellsy - 1); celly++) {
+        for (cellx = cellx0; cellx <= std::min(cellx0 + radius, grid.numcellsx - 1); cellx++) {
+          if ((cellx != cellx0 + radius) && (celly != celly0 - radius) && (celly != celly0 + radius)) {
             continue;
           }
-        }
-        pointvisible = true;
-        for (iter2 = polys.begin(); iter2 != polys.end(); iter2++) {
-          if (iter2->IsHole()) {
-            continue;
-          }
-          for (i2 = 0; i2 < iter2->GetNumPoints(); i2++) {
-            linep1 = iter2->GetPoint(i2);
-            linep2 = iter2->GetPoint((i2 + 1) % (iter2->GetNumPoints()));
-            if (Intersects(holepoint, polypoint, linep1, linep2)) {
-              pointvisible = false;
-              break;
+          for (entry = grid.vertexlists[celly * grid.numcellsx + cellx]; entry >= 0; entry = grid.entries[entry + 1]) {
+            v = &(vertices[grid.entries[entry]]);
+            if (v->p.x <= holepoint.x) {
+              continue;
+            }
+            if (!InCone(v->previous->p, v->p, v->next->p, holepoint)) {
+              continue;
             }
+            v->distance = Distance(holepoint, v->p);
+            candidates[numcandidates++] = v - vertices;
+            std::push_heap(candidates, candidates + numcandidates, RingVertexSorter(vertices));
           }
-          if (!pointvisible) {
+        }
+      }
+
+      // Vertices in the next ring are at least radius cells away,
+      // one more cell is left as a margin for rounding errors.
+      bound = (radius - 1) * cellsize;
+      while (numcandidates > 0) {
+        v = &(vertices[candidates[0]]);
+        if (pointfound) {
+          if (v->distance != polyvertex->distance) {
             break;
           }
+        } else if ((radius < maxradius) && !(v->distance < bound)) {
+          break;
         }
-        if (pointvisible) {
-          pointfound = true;
-          bestpolypoint = polypoint;
-          polyiter = iter;
-          polypointindex = i;
+        std::pop_heap(candidates, candidates + numcandidates, RingVertexSorter(vertices));
+        numcandidates--;
+        if (pointfound && !IsBefore(polyvertex, v, ringheads, ringorder)) {
+          continue;
+        }
+        if (Intersects(&grid, holepoint, v->p)) {
+          continue;
         }
+        pointfound = true;
+        polyvertex = v;
       }
     }
 
     if (!pointfound) {
+      TPPLDeleteArray(candidates, numringvertices, workspace);
+      TPPLDeleteArray(rings, numrings, workspace);
+      TPPLDeleteArray(holes, numholes, workspace);
+      TPPLDeleteArray(vertices, numringvertices, workspace);
+      TPPLDeleteArray(ringheads, numpolys, workspace);
+      TPPLDeleteArray(ringorder, numpolys, workspace);
+      TPPLDeleteArray(ringsizes, numpolys, workspace);
+      TPPLDeleteArray(holepointindices, numpolys, workspace);
+      TPPLDeleteArray(holemaxx, numpolys, workspace);
       return 0;
     }
 
-    newpoly.Init(holeiter->GetNumPoints() + polyiter->GetNumPoints() + 2);
-    i2 = 0;
-    for (i = 0; i <= polypointindex; i++) {
-      newpoly[i2] = polyiter->GetPoint(i);
-      i2++;
-    }
-    for (i = 0; i <= holeiter->GetNumPoints(); i++) {
-      newpoly[i2] = holeiter->GetPoint((i + holepointindex) % holeiter->GetNumPoints());
-      i2++;
-    }
-    for (i = polypointindex; i < polyiter->GetNumPoints(); i++) {
-      newpoly[i2] = polyiter->GetPoint(i);
-      i2++;
-    }
-
-    polys.erase(holeiter);
-    polys.erase(polyiter);
-    polys.push_back(newpoly);
+    // Splice the hole into the ring after polyvertex, followed by
+    // copies of holevertex and polyvertex.
+    ring = polyvertex->ring;
+    holecopy = &(vertices[numvertices + 2 * j]);
+    polycopy = &(vertices[numvertices + 2 * j + 1]);
+    *holecopy = *holevertex;
+    *polycopy = *polyvertex;
+    holecopy->ring = ring;
+
+    grid.AddEdge(polyvertex->p, holevertex->p);
+    grid.AddEdge(holevertex->p, polyvertex->p);
+    v = holevertex;
+    do {
+      v->ring = ring;
+      grid.AddVertex(v - vertices, v->p);
+      grid.AddEdge(v->p, v->next->p);
+      v = v->next;
+    } while (v != holevertex);
+    grid.AddVertex(holecopy - vertices, holecopy->p);
+    grid.AddVertex(polycopy - vertices, polycopy->p);
+
+    next = polyvertex->next;
+    holevertex->previous->next = holecopy;
+    holecopy->next = polycopy;
+    polycopy->previous = holecopy;
+    polycopy->next = next;
+    next->previous = polycopy;
+    polyvertex->next = holevertex;
+    holevertex->previous = polyvertex;
+
+    ringsizes[ring] += ringsizes[holes[j]] + 2;
+    ringorder[ring] = nextorder;
+    nextorder++;
+    TPPL_STATS_ADD(numholesbridged, 1);
   }
 
-  for (iter = polys.begin(); iter != polys.end(); iter++) {
-    outpolys->push_back(*iter);
+  // Output the outer polygons in list order, starting each one
+  // at its first vertex.
+  std::sort(rings, rings + numrings, [ringorder](long ring1, long ring2) {
+    return ringorder[ring1] < ringorder[ring2];
+  });
+  i = 0;
+  for (j = 0; j < numrings; j++) {
+    ring = rings[j];
+    offsets[j] = i;
+    v = ringheads[ring];
+    for (k = 0; k < ringsizes[ring]; k++) {
+      indices[i++] = v->index;
+      v = v->next;
+    }
   }
 
+  TPPLDeleteArray(candidates, numringvertices, workspace);
+  TPPLDeleteArray(rings, numrings, workspace);
+  TPPLDeleteArray(holes, numholes, workspace);
+  TPPLDeleteArray(vertices, numringvertices, workspace);
+  TPPLDeleteArray(ringheads, numpolys, workspace);
+  TPPLDeleteArray(ringorder, numpolys, workspace);
+  TPPLDeleteArray(ringsizes, numpolys, workspace);
+  TPPLDeleteArray(holepointindices, numpolys, workspace);
+  TPPLDeleteArray(holemaxx, numpolys, workspace);
+
   return 1;
 }
 
 bool TPPLPartition::IsConvex(TPPLPoint &p1, TPPLPoint &p2, TPPLPoint &p3) {
-  tppl_float tmp;
-  tmp = (p3.y - p1.y) * (p2.x - p1.x) - (p3.x - p1.x) * (p2.y - p1.y);
-  if (tmp > 0) {
+  TPPL_STATS_ADD(numconvextests, 1);
+  if (TPPLOrient2D(p1, p2, p3) > 0) {
     return 1;
   } else {
     return 0;
@@ -326,9 +1983,8 @@ bool TPPLPartition::IsConvex(TPPLPoint &p1, TPPLPoint &p2, TPPLPoint &p3) {
 }
 
 bool TPPLPartition::IsReflex(TPPLPoint &p1, TPPLPoint &p2, TPPLPoint &p3) {
-  tppl_float tmp;
-  tmp = (p3.y - p1.y) * (p2.x - p1.x) - (p3.x - p1.x) * (p2.y - p1.y);
-  if (tmp < 0) {
+  TPPL_STATS_ADD(numconvextests, 1);
+  if (TPPLOrient2D(p1, p2, p3) < 0) {
     return 1;
   } else {
     return 0;
@@ -336,6 +1992,7 @@ bool TPPLPartition::IsReflex(TPPLPoint &p1, TPPLPoint &p2, TPPLPoint &p3) {
 }
 
 bool TPPLPartition::IsInside(TPPLPoint &p1, TPPLPoint &p2, TPPLPoint &p3, TPPLPoint &p) {
+  TPPL_STATS_ADD(numinsidetests, 1);
   if (IsConvex(p1, p, p2)) {
     return false;
   }
@@ -372,86 +2029,226 @@ bool TPPLPartition::InCone(TPPLPoint &p1, TPPLPoint &p2, TPPLPoint &p3, TPPLPoin
   }
 }
 
-bool TPPLPartition::InCone(PartitionVertex *v, TPPLPoint &p) {
-  TPPLPoint p1, p2, p3;
-
-  p1 = v->previous->p;
-  p2 = v->p;
-  p3 = v->next->p;
+bool TPPLPartition::InCone(PartitionVertex *v, TPPLPoint &p) {
+  TPPLPoint p1, p2, p3;
+
+  p1 = v->previous->p;
+  p2 = v->p;
+  p3 = v->next->p;
+
+  return InCone(p1, p2, p3, p);
+}
+
+void TPPLPartition::UpdateVertexReflexity(PartitionVertex *v) {
+  PartitionVertex *v1 = NULL, *v3 = NULL;
+  v1 = v->previous;
+  v3 = v->next;
+  v->isConvex = !IsReflex(v1->p, v->p, v3->p);
+}
+
+void TPPLPartition::UpdateVertex(PartitionVertex *v, VertexGrid *grid) {
+  long i, end, cellx, celly, cellx1, cellx2, celly1, celly2, cell;
+  PartitionVertex *v1 = NULL, *v3 = NULL, *v2 = NULL;
+  TPPLPoint vec1, vec3;
+
+  TPPL_STATS_ADD(numvertexupdates, 1);
+  v1 = v->previous;
+  v3 = v->next;
+
+  v->isConvex = IsConvex(v1->p, v->p, v3->p);
+  if (v->isConvex) {
+    grid->Remove(v->index);
+  } else {
+    grid->Insert(v->index);
+  }
+
+  if (v->isConvex) {
+    TPPL_STATS_ADD(numeartests, 1);
+    TPPLTriangleFilter<tppl_float> filter(v1->p, v->p, v3->p);
+    v->isEar = true;
+    // Only vertices in grid cells overlapping the bounding box
+    // of the ear can lie inside it.
+    cellx1 = grid->GetCellX(std::min(v->p.x, std::min(v1->p.x, v3->p.x)));
+    cellx2 = grid->GetCellX(std::max(v->p.x, std::max(v1->p.x, v3->p.x)));
+    celly1 = grid->GetCellY(std::min(v->p.y, std::min(v1->p.y, v3->p.y)));
+    celly2 = grid->GetCellY(std::max(v->p.y, std::max(v1->p.y, v3->p.y)));
+    for (celly = celly1; (celly <= celly2) && v->isEar; celly++) {
+      for (cellx = cellx1; (cellx <= cellx2) && v->isEar; cellx++) {
+        cell = celly * grid->numcellsx + cellx;
+        if (grid->cellcount[cell] == 0) {
+          continue;
+        }
+        end = grid->cellstart[cell] + grid->cellcount[cell];
+        for (i = filter.Find(grid->cellx, grid->celly, grid->cellstart[cell], end); i < end;
+                i = filter.Find(grid->cellx, grid->celly, i + 1, end)) {
+          v2 = &(grid->vertices[grid->cellvertices[i]]);
+          if ((v2->p.x == v->p.x) && (v2->p.y == v->p.y)) {
+            continue;
+          }
+          if ((v2->p.x == v1->p.x) && (v2->p.y == v1->p.y)) {
+            continue;
+          }
+          if ((v2->p.x == v3->p.x) && (v2->p.y == v3->p.y)) {
+            continue;
+          }
+          if (IsInside(v1->p, v->p, v3->p, v2->p)) {
+            v->isEar = false;
+            break;
+          }
+        }
+      }
+    }
+  } else {
+    v->isEar = false;
+  }
+
+  if (!v->isEar) {
+    return;
+  }
+
+  // Higher priority is given to smaller angles, i.e. larger cosines.
+  vec1 = v1->p - v->p;
+  vec3 = v3->p - v->p;
+  switch (earpolicy) {
+    case TPPL_EARPOLICY_FIRST:
+      v->angle = 0;
+      break;
+    case TPPL_EARPOLICY_MIN_MAX_ANGLE:
+      v->angle = std::min(SignedSquaredCosine(vec1, vec3),
+              std::min(SignedSquaredCosine(v->p - v1->p, v3->p - v1->p),
+                      SignedSquaredCosine(v->p - v3->p, v1->p - v3->p)));
+      break;
+    default:
+      v->angle = SignedSquaredCosine(vec1, vec3);
+      break;
+  }
+}
+
+TPPLPartition::EarHeap::EarHeap(PartitionVertex *vertices, long numvertices, TPPLWorkspace *workspace) {
+  long i;
+  this->vertices = vertices;
+  this->numvertices = numvertices;
+  this->workspace = workspace;
+  size = 0;
+  heap = TPPLNewArray<long>(numvertices, workspace);
+  positions = TPPLNewArray<long>(numvertices, workspace);
+  for (i = 0; i < numvertices; i++) {
+    positions[i] = -1;
+  }
+}
 
-  return InCone(p1, p2, p3, p);
+TPPLPartition::EarHeap::~EarHeap() {
+  TPPLDeleteArray(heap, numvertices, workspace);
+  TPPLDeleteArray(positions, numvertices, workspace);
 }
 
-void TPPLPartition::UpdateVertexReflexity(PartitionVertex *v) {
-  PartitionVertex *v1 = NULL, *v3 = NULL;
-  v1 = v->previous;
-  v3 = v->next;
-  v->isConvex = !IsReflex(v1->p, v->p, v3->p);
+bool TPPLPartition::EarHeap::Before(long index1, long index2) {
+  if (vertices[index1].angle != vertices[index2].angle) {
+    return vertices[index1].angle > vertices[index2].angle;
+  }
+  return index1 < index2;
 }
 
-void TPPLPartition::UpdateVertex(PartitionVertex *v, PartitionVertex *vertices, long numvertices) {
-  long i;
-  PartitionVertex *v1 = NULL, *v3 = NULL;
-  TPPLPoint vec1, vec3;
+void TPPLPartition::EarHeap::Move(long index, long position) {
+  heap[position] = index;
+  positions[index] = position;
+}
 
-  v1 = v->previous;
-  v3 = v->next;
+void TPPLPartition::EarHeap::SiftUp(long position) {
+  long index, parent;
+  index = heap[position];
+  while (position > 0) {
+    parent = (position - 1) / 2;
+    if (!Before(index, heap[parent])) {
+      break;
+    }
+    Move(heap[parent], position);
+    position = parent;
+  }
+  Move(index, position);
+}
 
-  v->isConvex = IsConvex(v1->p, v->p, v3->p);
+void TPPLPartition::EarHeap::SiftDown(long position) {
+  long index, child;
+  index = heap[position];
+  while ((child = 2 * position + 1) < size) {
+    if ((child + 1 < size) && Before(heap[child + 1], heap[child])) {
+      child++;
+    }
+    if (!Before(heap[child], index)) {
+      break;
+    }
+    Move(heap[child], position);
+    position = child;
+  }
+  Move(index, position);
+}
 
-  vec1 = Normalize(v1->p - v->p);
-  vec3 = Normalize(v3->p - v->p);
-  v->angle = vec1.x * vec3.x + vec1.y * vec3.y;
+void TPPLPartition::EarHeap::Update(long index) {
+  long position, last;
+  position = positions[index];
 
-  if (v->isConvex) {
-    v->isEar = true;
-    for (i = 0; i < numvertices; i++) {
-      if ((vertices[i].p.x == v->p.x) && (vertices[i].p.y == v->p.y)) {
-        continue;
-      }
-      if ((vertices[i].p.x == v1->p.x) && (vertices[i].p.y == v1->p.y)) {
-        continue;
-      }
-      if ((vertices[i].p.x == v3->p.x) && (vertices[i].p.y == v3->p.y)) {
-        continue;
-      }
-      if (IsInside(v1->p, v->p, v3->p, vertices[i].p)) {
-        v->isEar = false;
-        break;
-      }
+  if (vertices[index].isActive && vertices[index].isEar) {
+    if (position < 0) {
+      position = size;
+      size++;
+      Move(index, position);
+    }
+    SiftUp(position);
+    SiftDown(positions[index]);
+  } else if (position >= 0) {
+    positions[index] = -1;
+    size--;
+    if (position < size) {
+      last = heap[size];
+      Move(last, position);
+      SiftUp(position);
+      SiftDown(positions[last]);
     }
-  } else {
-    v->isEar = false;
   }
 }
 
 // Triangulation by ear removal.
 int TPPLPartition::Triangulate_EC(TPPLPoly *poly, TPPLPolyList *triangles) {
+  TriangleSink sink(triangles);
+  return Triangulate_EC(poly, &sink);
+}
+
+int TPPLPartition::Triangulate_EC(TPPLPoly *poly, uint32_t *indices) {
+  TriangleSink sink(indices);
+  return Triangulate_EC(poly, &sink);
+}
+
+int TPPLPartition::Triangulate_EC(TPPLPoly *poly, TriangleSink *sink) {
   if (!poly->Valid()) {
     return 0;
   }
 
+  TPPLWorkspaceScope scope(workspace);
+  TPPL_STATS_SCOPE();
+  TPPL_STATS_TIMER(timer, earclippingtime);
   long numvertices;
   PartitionVertex *vertices = NULL;
   PartitionVertex *ear = NULL;
-  TPPLPoly triangle;
-  long i, j;
-  bool earfound;
+  long i;
+
+  sink->points = poly->GetPoints();
 
   if (poly->GetNumPoints() < 3) {
     return 0;
   }
   if (poly->GetNumPoints() == 3) {
-    triangles->push_back(*poly);
+    sink->Add(0, 1, 2);
     return 1;
   }
 
   numvertices = poly->GetNumPoints();
 
-  vertices = new PartitionVertex[numvertices];
+  vertices = TPPLNewArray<PartitionVertex>(numvertices, workspace);
   for (i = 0; i < numvertices; i++) {
     vertices[i].isActive = true;
     vertices[i].p = poly->GetPoint(i);
+    vertices[i].index = i;
     if (i == (numvertices - 1)) {
       vertices[i].next = &(vertices[0]);
     } else {
@@ -464,73 +2261,220 @@ int TPPLPartition::Triangulate_EC(TPPLPoly *poly, TPPLPolyList *triangles) {
     }
   }
   for (i = 0; i < numvertices; i++) {
-    UpdateVertex(&vertices[i], vertices, numvertices);
+    vertices[i].isConvex = IsConvex(vertices[i].previous->p, vertices[i].p, vertices[i].next->p);
+  }
+  VertexGrid grid(vertices, numvertices, workspace);
+  EarHeap heap(vertices, numvertices, workspace);
+  for (i = 0; i < numvertices; i++) {
+    UpdateVertex(&vertices[i], &grid);
+    heap.Update(i);
   }
 
   for (i = 0; i < numvertices - 3; i++) {
-    earfound = false;
-    // Find the most extruded ear.
-    for (j = 0; j < numvertices; j++) {
-      if (!vertices[j].isActive) {
-        continue;
-      }
-      if (!vertices[j].isEar) {
-        continue;
-      }
-      if (!earfound) {
-        earfound = true;
-        ear = &(vertices[j]);
-      } else {
-        if (vertices[j].angle > ear->angle) {
-          ear = &(vertices[j]);
-        }
-      }
-    }
-    if (!earfound) {
-      delete[] vertices;
+    if (heap.size == 0) {
+      TPPLDeleteArray(vertices, numvertices, workspace);
       return 0;
     }
+    ear = &(vertices[heap.heap[0]]);
 
-    triangle.Triangle(ear->previous->p, ear->p, ear->next->p);
-    triangles->push_back(triangle);
+    sink->Add(ear->previous->index, ear->index, ear->next->index);
 
     ear->isActive = false;
     ear->previous->next = ear->next;
     ear->next->previous = ear->previous;
+    heap.Update(ear->index);
 
     if (i == numvertices - 4) {
       break;
     }
 
-    UpdateVertex(ear->previous, vertices, numvertices);
-    UpdateVertex(ear->next, vertices, numvertices);
+    UpdateVertex(ear->previous, &grid);
+    heap.Update(ear->previous->index);
+    UpdateVertex(ear->next, &grid);
+    heap.Update(ear->next->index);
   }
   for (i = 0; i < numvertices; i++) {
     if (vertices[i].isActive) {
-      triangle.Triangle(vertices[i].previous->p, vertices[i].p, vertices[i].next->p);
-      triangles->push_back(triangle);
+      sink->Add(vertices[i].previous->index, vertices[i].index, vertices[i].next->index);
       break;
     }
   }
 
-  delete[] vertices;
+  TPPLDeleteArray(vertices, numvertices, workspace);
 
   return 1;
 }
 
 int TPPLPartition::Triangulate_EC(TPPLPolyList *inpolys, TPPLPolyList *triangles) {
-  TPPLPolyList outpolys;
-  TPPLPolyList::iterator iter;
+  TriangleSink sink(triangles);
+  return Triangulate_EC(inpolys, &sink);
+}
 
-  if (!RemoveHoles(inpolys, &outpolys)) {
+int TPPLPartition::Triangulate_EC(TPPLPolyList *inpolys, uint32_t *indices) {
+  TriangleSink sink(indices);
+  return Triangulate_EC(inpolys, &sink);
+}
+
+int TPPLPartition::Triangulate_EC(TPPLPolyList *inpolys, TriangleSink *sink) {
+  TPPLWorkspaceScope scope(workspace);
+  TPPL_STATS_SCOPE();
+  TPPLMonotonePieces localpolys;
+  TPPLMonotonePieces *outpolys = workspace ? &(workspace->outerpolys) : &localpolys;
+  TPPLPoint *points;
+  TPPLPoly *polyarray;
+  long *polyoffsets, *polyindices;
+  TPPLPartition *partitions;
+  TPPLPoly **polys;
+  const long **remaps;
+  TPPLPolyList *lists;
+  long *order, *offsets, *counts;
+  int *rets;
+  long i, numpolys, numpoints, numtriangles;
+  int threads, ret;
+
+  if (!RemoveHoles(inpolys, outpolys)) {
     return 0;
   }
-  for (iter = outpolys.begin(); iter != outpolys.end(); iter++) {
-    if (!Triangulate_EC(&(*iter), triangles)) {
-      return 0;
+
+  // Every polygon uses its own run of points in place.
+  numpolys = outpolys->GetNumPieces();
+  numpoints = outpolys->GetNumIndices();
+  polyoffsets = outpolys->GetOffsets();
+  polyindices = outpolys->GetIndices();
+  points = TPPLNewArray<TPPLPoint>(numpoints, workspace);
+  polyarray = TPPLNewArray<TPPLPoly>(numpolys, workspace);
+  for (i = 0; i < numpoints; i++) {
+    points[i] = outpolys->GetPoints()[polyindices[i]];
+  }
+  for (i = 0; i < numpolys; i++) {
+    polyarray[i].Attach(points + polyoffsets[i], outpolys->GetNumVertices(i));
+  }
+
+  threads = GetThreadCount(100 * numpoints);
+  if (threads > (int)numpolys) {
+    threads = (int)numpolys;
+  }
+
+  if (threads <= 1) {
+    ret = 1;
+    for (i = 0; i < numpolys; i++) {
+      sink->remap = polyindices + polyoffsets[i];
+      if (!Triangulate_EC(&(polyarray[i]), sink)) {
+        ret = 0;
+        break;
+      }
     }
+    TPPLDeleteArray(polyarray, numpolys, workspace);
+    TPPLDeleteArray(points, numpoints, workspace);
+    return ret;
   }
-  return 1;
+
+  // Triangulates the polygons in parallel, largest first. Triangles go
+  // to a list per polygon or to the polygon's place in the index buffer,
+  // and are collected in polygon order afterwards.
+  polys = TPPLNewArray<TPPLPoly *>(numpolys);
+  remaps = TPPLNewArray<const long *>(numpolys);
+  order = TPPLNewArray<long>(numpolys);
+  offsets = TPPLNewArray<long>(numpolys);
+  counts = TPPLNewArray<long>(numpolys);
+  rets = TPPLNewArray<int>(numpolys);
+  lists = sink->triangles ? TPPLNewArray<TPPLPolyList>(numpolys) : NULL;
+  partitions = TPPLNewArray<TPPLPartition>(threads);
+
+  for (i = 0; i < numpolys; i++) {
+    polys[i] = &(polyarray[i]);
+    remaps[i] = polyindices + polyoffsets[i];
+    order[i] = i;
+    offsets[i] = (i > 0) ? offsets[i - 1] + polys[i - 1]->GetNumPoints() - 2 : 0;
+  }
+  std::sort(order, order + numpolys, PolySizeSorter(polys));
+
+  for (i = 0; i < threads; i++) {
+    partitions[i] = *this;
+    partitions[i].numthreads = 1;
+    if (i > 0) {
+      partitions[i].workspace = NULL;
+    }
+    // The threads count into statistics of their own.
+    partitions[i].stats = NULL;
+  }
+
+  TPPLRunBatch(threads, numpolys, order, [&](int thread, long job) {
+    TriangleSink polysink(sink->indices ? sink->indices + 3 * (sink->numtriangles + offsets[job]) : NULL);
+    if (lists) {
+      polysink.triangles = &lists[job];
+    }
+    polysink.remap = remaps[job];
+    rets[job] = partitions[thread].Triangulate_EC(polys[job], &polysink);
+    counts[job] = polysink.numtriangles;
+  });
+
+  ret = 1;
+  numtriangles = sink->numtriangles;
+  for (i = 0; i < numpolys; i++) {
+    if (lists) {
+      sink->triangles->splice(sink->triangles->end(), lists[i]);
+    } else if (sink->numtriangles != numtriangles + offsets[i]) {
+      memmove(sink->indices + 3 * sink->numtriangles,
+              sink->indices + 3 * (numtriangles + offsets[i]),
+              3 * counts[i] * sizeof(uint32_t));
+    }
+    sink->numtriangles += counts[i];
+    if (!rets[i]) {
+      ret = 0;
+      break;
+    }
+  }
+
+  TPPLDeleteArray(partitions, threads);
+  if (lists) {
+    TPPLDeleteArray(lists, numpolys);
+  }
+  TPPLDeleteArray(rets, numpolys);
+  TPPLDeleteArray(counts, numpolys);
+  TPPLDeleteArray(offsets, numpolys);
+  TPPLDeleteArray(order, numpolys);
+  TPPLDeleteArray(remaps, numpolys);
+  TPPLDeleteArray(polys, numpolys);
+  TPPLDeleteArray(polyarray, numpolys, workspace);
+  TPPLDeleteArray(points, numpoints, workspace);
+
+  return ret;
+}
+
+// Compares the triangle edge starting at points[edge] with the edge
+// p1-p2, by the start point first and then the end point.
+static int CompareEdge(TPPLPoint *points, long edge, const TPPLPoint &p1, const TPPLPoint &p2) {
+  const TPPLPoint &q1 = points[edge];
+  const TPPLPoint &q2 = points[edge - edge % 3 + (edge % 3 + 1) % 3];
+  if (q1.x != p1.x) {
+    return (q1.x < p1.x) ? -1 : 1;
+  }
+  if (q1.y != p1.y) {
+    return (q1.y < p1.y) ? -1 : 1;
+  }
+  if (q2.x != p2.x) {
+    return (q2.x < p2.x) ? -1 : 1;
+  }
+  if (q2.y != p2.y) {
+    return (q2.y < p2.y) ? -1 : 1;
+  }
+  return 0;
+}
+
+bool TPPLPartition::PolySizeSorter::operator()(long index1, long index2) {
+  if (polys[index1]->GetNumPoints() != polys[index2]->GetNumPoints()) {
+    return polys[index1]->GetNumPoints() > polys[index2]->GetNumPoints();
+  }
+  return index1 < index2;
+}
+
+bool TPPLPartition::PartitionEdgeSorter::operator()(long index1, long index2) {
+  int c = CompareEdge(points, index1, points[index2], points[index2 - index2 % 3 + (index2 % 3 + 1) % 3]);
+  if (c != 0) {
+    return c < 0;
+  }
+  return index1 < index2;
 }
 
 int TPPLPartition::ConvexPartition_HM(TPPLPoly *poly, TPPLPolyList *parts) {
@@ -538,13 +2482,20 @@ int TPPLPartition::ConvexPartition_HM(TPPLPoly *poly, TPPLPolyList *parts) {
     return 0;
   }
 
-  TPPLPolyList triangles;
-  TPPLPolyList::iterator iter1, iter2;
-  TPPLPoly *poly1 = NULL, *poly2 = NULL;
+  TPPLWorkspaceScope scope(workspace);
+  TPPL_STATS_SCOPE();
   TPPLPoly newpoly;
-  TPPLPoint d1, d2, p1, p2, p3;
-  long i11, i12, i21, i22, i13, i23, j, k;
-  bool isdiagonal;
+  TPPLPoint p1, p2, p3;
+  PartitionEdge *edges = NULL;
+  TPPLPoint *points = NULL;
+  uint32_t *indices = NULL;
+  long *sortededges = NULL;
+  long *heads = NULL;
+  long *sizes = NULL;
+  bool *isMerged = NULL;
+  long *queue = NULL;
+  long i11, i12, i13, i, j, k, lo, hi, numtriangles, numedges, queuefront, queueback;
+  long e, f, t, t2;
   long numreflex;
 
   // Check if the poly is already convex.
@@ -570,266 +2521,452 @@ int TPPLPartition::ConvexPartition_HM(TPPLPoly *poly, TPPLPolyList *parts) {
     return 1;
   }
 
-  if (!Triangulate_EC(poly, &triangles)) {
+  numtriangles = GetNumTriangles(poly);
+  numedges = 3 * numtriangles;
+  indices = TPPLNewArray<uint32_t>(numedges, workspace);
+  if (!Triangulate_EC(poly, indices)) {
+    TPPLDeleteArray(indices, numedges, workspace);
     return 0;
   }
-
-  for (iter1 = triangles.begin(); iter1 != triangles.end(); iter1++) {
-    poly1 = &(*iter1);
-    for (i11 = 0; i11 < poly1->GetNumPoints(); i11++) {
-      d1 = poly1->GetPoint(i11);
-      i12 = (i11 + 1) % (poly1->GetNumPoints());
-      d2 = poly1->GetPoint(i12);
-
-      isdiagonal = false;
-      for (iter2 = iter1; iter2 != triangles.end(); iter2++) {
-        if (iter1 == iter2) {
-          continue;
+  TPPL_STATS_TIMER(timer, mergetime);
+
+  // Link the edges of every triangle, edge 3*t+i starts at vertex i
+  // of triangle t.
+  points = TPPLNewArray<TPPLPoint>(numedges, workspace);
+  edges = TPPLNewArray<PartitionEdge>(numedges, workspace);
+  sortededges = TPPLNewArray<long>(numedges, workspace);
+  heads = TPPLNewArray<long>(numtriangles, workspace);
+  sizes = TPPLNewArray<long>(numtriangles, workspace);
+  isMerged = TPPLNewArray<bool>(numtriangles, workspace);
+  // Every merge adds at most three edges, so the queue of a triangle
+  // never holds more than numedges.
+  queue = TPPLNewArray<long>(numedges, workspace);
+  for (t = 0; t < numtriangles; t++) {
+    for (i = 0; i < 3; i++) {
+      e = 3 * t + i;
+      points[e] = poly->GetPoint(indices[e]);
+      edges[e].previous = 3 * t + (i + 2) % 3;
+      edges[e].next = 3 * t + (i + 1) % 3;
+      edges[e].isQueued = false;
+      sortededges[e] = e;
+    }
+    heads[t] = 3 * t;
+    sizes[t] = 3;
+    isMerged[t] = false;
+  }
+  TPPLDeleteArray(indices, numedges, workspace);
+
+  // Sort the edges by their endpoints, so that the other side of a
+  // diagonal can be found by binary search.
+  std::sort(sortededges, sortededges + numedges, PartitionEdgeSorter(points));
+
+  // Grow every remaining triangle, in order, by merging it with the
+  // later triangles across its diagonals. Edges are checked in order
+  // around the polygon, and after every merge the check continues from
+  // the end of the removed diagonal, so the edges not checked yet come
+  // first. After them, the edge before the diagonal needs another check,
+  // as its end changed, followed by the edges of the merged triangle.
+  for (t = 0; t < numtriangles; t++) {
+    if (isMerged[t]) {
+      continue;
+    }
+    queueback = 0;
+    for (i = 0; i < 3; i++) {
+      queue[queueback] = 3 * t + i;
+      queueback++;
+      edges[3 * t + i].isQueued = true;
+    }
+    for (queuefront = 0; queuefront < queueback; queuefront++) {
+      e = queue[queuefront];
+      edges[e].isQueued = false;
+
+      // Find the first later triangle with the same edge in the
+      // opposite direction.
+      p1 = points[e];
+      p2 = points[edges[e].next];
+      lo = 0;
+      hi = numedges;
+      while (lo < hi) {
+        k = (lo + hi) / 2;
+        if (CompareEdge(points, sortededges[k], p2, p1) < 0) {
+          lo = k + 1;
+        } else {
+          hi = k;
         }
-        poly2 = &(*iter2);
-
-        for (i21 = 0; i21 < poly2->GetNumPoints(); i21++) {
-          if ((d2.x != poly2->GetPoint(i21).x) || (d2.y != poly2->GetPoint(i21).y)) {
-            continue;
-          }
-          i22 = (i21 + 1) % (poly2->GetNumPoints());
-          if ((d1.x != poly2->GetPoint(i22).x) || (d1.y != poly2->GetPoint(i22).y)) {
-            continue;
-          }
-          isdiagonal = true;
+      }
+      f = -1;
+      for (k = lo; k < numedges; k++) {
+        if (CompareEdge(points, sortededges[k], p2, p1) != 0) {
           break;
         }
-        if (isdiagonal) {
+        t2 = sortededges[k] / 3;
+        if ((t2 > t) && !isMerged[t2]) {
+          f = sortededges[k];
           break;
         }
       }
-
-      if (!isdiagonal) {
+      if (f < 0) {
         continue;
       }
 
-      p2 = poly1->GetPoint(i11);
-      if (i11 == 0) {
-        i13 = poly1->GetNumPoints() - 1;
-      } else {
-        i13 = i11 - 1;
-      }
-      p1 = poly1->GetPoint(i13);
-      if (i22 == (poly2->GetNumPoints() - 1)) {
-        i23 = 0;
-      } else {
-        i23 = i22 + 1;
-      }
-      p3 = poly2->GetPoint(i23);
-
+      p2 = points[e];
+      p1 = points[edges[e].previous];
+      p3 = points[edges[edges[f].next].next];
       if (!IsConvex(p1, p2, p3)) {
         continue;
       }
 
-      p2 = poly1->GetPoint(i12);
-      if (i12 == (poly1->GetNumPoints() - 1)) {
-        i13 = 0;
-      } else {
-        i13 = i12 + 1;
-      }
-      p3 = poly1->GetPoint(i13);
-      if (i21 == 0) {
-        i23 = poly2->GetNumPoints() - 1;
-      } else {
-        i23 = i21 - 1;
-      }
-      p1 = poly2->GetPoint(i23);
-
+      p2 = points[edges[e].next];
+      p3 = points[edges[edges[e].next].next];
+      p1 = points[edges[f].previous];
       if (!IsConvex(p1, p2, p3)) {
         continue;
       }
 
-      newpoly.Init(poly1->GetNumPoints() + poly2->GetNumPoints() - 2);
-      k = 0;
-      for (j = i12; j != i11; j = (j + 1) % (poly1->GetNumPoints())) {
-        newpoly[k] = poly1->GetPoint(j);
-        k++;
-      }
-      for (j = i22; j != i21; j = (j + 1) % (poly2->GetNumPoints())) {
-        newpoly[k] = poly2->GetPoint(j);
-        k++;
+      t2 = f / 3;
+      i = edges[e].previous;
+      j = edges[f].next;
+      edges[i].next = j;
+      edges[j].previous = i;
+      i = edges[f].previous;
+      j = edges[e].next;
+      edges[i].next = j;
+      edges[j].previous = i;
+
+      heads[t] = edges[e].next;
+      sizes[t] += sizes[t2] - 2;
+      isMerged[t2] = true;
+
+      if (!edges[edges[e].previous].isQueued) {
+        queue[queueback] = edges[e].previous;
+        queueback++;
+        edges[edges[e].previous].isQueued = true;
       }
+      queue[queueback] = edges[f].next;
+      queueback++;
+      edges[edges[f].next].isQueued = true;
+      queue[queueback] = edges[f].previous;
+      queueback++;
+      edges[edges[f].previous].isQueued = true;
+    }
+  }
 
-      triangles.erase(iter2);
-      *iter1 = newpoly;
-      poly1 = &(*iter1);
-      i11 = -1;
-
+  for (t = 0; t < numtriangles; t++) {
+    if (isMerged[t]) {
       continue;
     }
+    newpoly.Init(sizes[t]);
+    e = heads[t];
+    for (i = 0; i < sizes[t]; i++) {
+      newpoly[i] = points[e];
+      e = edges[e].next;
+    }
+    parts->push_back(std::move(newpoly));
   }
 
-  for (iter1 = triangles.begin(); iter1 != triangles.end(); iter1++) {
-    parts->push_back(*iter1);
-  }
+  TPPLDeleteArray(points, numedges, workspace);
+  TPPLDeleteArray(edges, numedges, workspace);
+  TPPLDeleteArray(sortededges, numedges, workspace);
+  TPPLDeleteArray(heads, numtriangles, workspace);
+  TPPLDeleteArray(sizes, numtriangles, workspace);
+  TPPLDeleteArray(isMerged, numtriangles, workspace);
+  TPPLDeleteArray(queue, numedges, workspace);
 
   return 1;
 }
 
 int TPPLPartition::ConvexPartition_HM(TPPLPolyList *inpolys, TPPLPolyList *parts) {
+  TPPL_STATS_SCOPE();
   TPPLPolyList outpolys;
   TPPLPolyList::iterator iter;
+  TPPLPartition *partitions;
+  TPPLPoly **polys;
+  TPPLPolyList *lists;
+  long *order;
+  int *rets;
+  long i, numpolys, numpoints;
+  int threads, ret;
 
   if (!RemoveHoles(inpolys, &outpolys)) {
     return 0;
   }
+
+  numpolys = 0;
+  numpoints = 0;
   for (iter = outpolys.begin(); iter != outpolys.end(); iter++) {
-    if (!ConvexPartition_HM(&(*iter), parts)) {
-      return 0;
+    numpolys++;
+    numpoints += iter->GetNumPoints();
+  }
+  threads = GetThreadCount(100 * numpoints);
+  if (threads > (int)numpolys) {
+    threads = (int)numpolys;
+  }
+
+  if (threads <= 1) {
+    for (iter = outpolys.begin(); iter != outpolys.end(); iter++) {
+      if (!ConvexPartition_HM(&(*iter), parts)) {
+        return 0;
+      }
+    }
+    return 1;
+  }
+
+  // Partitions the polygons in parallel, largest first, each into its
+  // own list. The lists are appended in polygon order afterwards.
+  polys = TPPLNewArray<TPPLPoly *>(numpolys);
+  order = TPPLNewArray<long>(numpolys);
+  rets = TPPLNewArray<int>(numpolys);
+  lists = TPPLNewArray<TPPLPolyList>(numpolys);
+  partitions = TPPLNewArray<TPPLPartition>(threads);
+
+  i = 0;
+  for (iter = outpolys.begin(); iter != outpolys.end(); iter++) {
+    polys[i] = &(*iter);
+    order[i] = i;
+    i++;
+  }
+  std::sort(order, order + numpolys, PolySizeSorter(polys));
+
+  for (i = 0; i < threads; i++) {
+    partitions[i] = *this;
+    partitions[i].numthreads = 1;
+    if (i > 0) {
+      partitions[i].workspace = NULL;
     }
+    // The threads count into statistics of their own.
+    partitions[i].stats = NULL;
   }
-  return 1;
+
+  TPPLRunBatch(threads, numpolys, order, [&](int thread, long job) {
+    rets[job] = partitions[thread].ConvexPartition_HM(polys[job], &lists[job]);
+  });
+
+  ret = 1;
+  for (i = 0; i < numpolys; i++) {
+    parts->splice(parts->end(), lists[i]);
+    if (!rets[i]) {
+      ret = 0;
+      break;
+    }
+  }
+
+  TPPLDeleteArray(partitions, threads);
+  TPPLDeleteArray(lists, numpolys);
+  TPPLDeleteArray(rets, numpolys);
+  TPPLDeleteArray(order, numpolys);
+  TPPLDeleteArray(polys, numpolys);
+
+  return ret;
 }
 
 // Minimum-weight polygon triangulation by dynamic programming.
 // Time complexity: O(n^3)
 // Space complexity: O(n^2)
 int TPPLPartition::Triangulate_OPT(TPPLPoly *poly, TPPLPolyList *triangles) {
+  TriangleSink sink(triangles);
+  return Triangulate_OPT(poly, &sink);
+}
+
+int TPPLPartition::Triangulate_OPT(TPPLPoly *poly, uint32_t *indices) {
+  TriangleSink sink(indices);
+  return Triangulate_OPT(poly, &sink);
+}
+
+// Finds the vertex k splitting the diagonal i-j into the lightest
+// triangulation. Returns -1 if there is none.
+long TPPLPartition::GetBestVertex(long i, long j, DPState **rows, DPState **columns, tppl_float *minweight) {
+  DPState *row = rows[i];
+  DPState *column = columns[j];
+  long k, bestvertex;
+  tppl_float weight;
+
+  bestvertex = -1;
+  for (k = (i + 1); k < j; k++) {
+    if ((row[k].length < 0) || (column[k].length < 0)) {
+      continue;
+    }
+
+    weight = row[k].weight + column[k].weight + row[k].length + column[k].length;
+
+    if ((bestvertex == -1) || (weight < *minweight)) {
+      bestvertex = k;
+      *minweight = weight;
+    }
+  }
+  return bestvertex;
+}
+
+int TPPLPartition::GetVisibilityGraph(TPPLPoly *poly, TPPLVisibilityGraph *graph) {
   if (!poly->Valid()) {
     return 0;
   }
 
-  long i, j, k, gap, n;
-  DPState **dpstates = NULL;
-  TPPLPoint p1, p2, p3, p4;
-  long bestvertex;
-  tppl_float weight, minweight, d1, d2;
-  Diagonal diagonal, newdiagonal;
-  DiagonalList diagonals;
-  TPPLPoly triangle;
-  int ret = 1;
+  TPPL_STATS_SCOPE();
+  TPPL_STATS_TIMER(timer, visibilitytime);
+  long i, j, n;
+  std::atomic<long> nextrow(0);
+  int threads;
 
   n = poly->GetNumPoints();
-  dpstates = new DPState *[n];
-  for (i = 1; i < n; i++) {
-    dpstates[i] = new DPState[i];
-  }
+  graph->Init(n);
 
-  // Initialize states and visibility.
-  for (i = 0; i < (n - 1); i++) {
-    p1 = poly->GetPoint(i);
-    for (j = i + 1; j < n; j++) {
-      dpstates[j][i].visible = true;
-      dpstates[j][i].weight = 0;
-      dpstates[j][i].bestvertex = -1;
-      if (j != (i + 1)) {
-        p2 = poly->GetPoint(j);
+  // Threads take a row at a time and only set the upper half of it,
+  // the lower half is mirrored afterwards.
+  threads = GetThreadCount(n * n * 64);
+  TPPLRunThreads(threads, [&](int) {
+    EdgeGrid grid(poly, n, NULL);
+    long i, j;
+    TPPLPoint p1, p2, p3, p4;
 
-        // Visibility check.
-        if (i == 0) {
-          p3 = poly->GetPoint(n - 1);
-        } else {
-          p3 = poly->GetPoint(i - 1);
-        }
-        if (i == (n - 1)) {
-          p4 = poly->GetPoint(0);
-        } else {
-          p4 = poly->GetPoint(i + 1);
-        }
+    for (i = 0; i < n; i++) {
+      grid.AddEdge(poly->GetPoint(i), poly->GetPoint((i + 1) % n));
+    }
+
+    while ((i = nextrow++) < (n - 1)) {
+      p1 = poly->GetPoint(i);
+      p3 = poly->GetPoint((i + n - 1) % n);
+      p4 = poly->GetPoint((i + 1) % n);
+      graph->SetVisible(i, i + 1, true);
+      for (j = i + 2; j < n; j++) {
+        p2 = poly->GetPoint(j);
         if (!InCone(p3, p1, p4, p2)) {
-          dpstates[j][i].visible = false;
           continue;
         }
-
-        if (j == 0) {
-          p3 = poly->GetPoint(n - 1);
-        } else {
-          p3 = poly->GetPoint(j - 1);
-        }
-        if (j == (n - 1)) {
-          p4 = poly->GetPoint(0);
-        } else {
-          p4 = poly->GetPoint(j + 1);
-        }
-        if (!InCone(p3, p2, p4, p1)) {
-          dpstates[j][i].visible = false;
+        if (!InCone(poly->GetPoint(j - 1), p2, poly->GetPoint((j + 1) % n), p1)) {
           continue;
         }
-
-        for (k = 0; k < n; k++) {
-          p3 = poly->GetPoint(k);
-          if (k == (n - 1)) {
-            p4 = poly->GetPoint(0);
-          } else {
-            p4 = poly->GetPoint(k + 1);
-          }
-          if (Intersects(p1, p2, p3, p4)) {
-            dpstates[j][i].visible = false;
-            break;
-          }
+        if (Intersects(&grid, p1, p2)) {
+          continue;
         }
+        graph->SetVisible(i, j, true);
       }
     }
+  });
+  graph->SetVisible(0, n - 1, true);
+
+  for (i = 0; i < n; i++) {
+    for (j = 0; j < i; j++) {
+      graph->SetVisible(i, j, graph->IsVisible(j, i));
+    }
   }
-  dpstates[n - 1][0].visible = true;
-  dpstates[n - 1][0].weight = 0;
-  dpstates[n - 1][0].bestvertex = -1;
 
-  for (gap = 2; gap < n; gap++) {
-    for (i = 0; i < (n - gap); i++) {
-      j = i + gap;
-      if (!dpstates[j][i].visible) {
-        continue;
-      }
-      bestvertex = -1;
-      for (k = (i + 1); k < j; k++) {
-        if (!dpstates[k][i].visible) {
-          continue;
-        }
-        if (!dpstates[j][k].visible) {
-          continue;
-        }
+  return 1;
+}
 
-        if (k <= (i + 1)) {
-          d1 = 0;
-        } else {
-          d1 = Distance(poly->GetPoint(i), poly->GetPoint(k));
-        }
-        if (j <= (k + 1)) {
-          d2 = 0;
-        } else {
-          d2 = Distance(poly->GetPoint(k), poly->GetPoint(j));
-        }
+int TPPLPartition::Triangulate_OPT(TPPLPoly *poly, TriangleSink *sink) {
+  if (!poly->Valid()) {
+    return 0;
+  }
+
+  TPPLWorkspaceScope scope(workspace);
+  TPPL_STATS_SCOPE();
+  long i, j, n, size;
+  DPState *states = NULL;
+  DPState **rows = NULL;
+  DPState **columns = NULL;
+  TPPLVisibilityGraph graph;
+  long bestvertex;
+  tppl_float minweight, length;
+  Diagonal diagonal, newdiagonal;
+  DiagonalList diagonals;
+  std::atomic<bool> failed(false);
+  int threads;
+  int ret = 1;
 
-        weight = dpstates[k][i].weight + dpstates[j][k].weight + d1 + d2;
+  n = poly->GetNumPoints();
+  sink->points = poly->GetPoints();
+
+  // rows[i][j] and columns[j][i] both hold the state of the diagonal i-j,
+  // i < j, in one contiguous triangular table each. The rows start n
+  // states into the array, as row i is indexed from i + 1.
+  size = n + n * (n - 1);
+  states = TPPLNewArray<DPState>(size, workspace);
+  rows = TPPLNewArray<DPState *>(n, workspace);
+  columns = TPPLNewArray<DPState *>(n, workspace);
+  for (i = 0; i < n; i++) {
+    rows[i] = states + n + i * (n - 1) - i * (i - 1) / 2 - (i + 1);
+    columns[i] = states + n + n * (n - 1) / 2 + i * (i - 1) / 2;
+  }
 
-        if ((bestvertex == -1) || (weight < minweight)) {
-          bestvertex = k;
-          minweight = weight;
+  if (!GetVisibilityGraph(poly, &graph)) {
+    TPPLDeleteArray(states, size, workspace);
+    TPPLDeleteArray(rows, n, workspace);
+    TPPLDeleteArray(columns, n, workspace);
+    return 0;
+  }
+  for (i = 0; i < (n - 1); i++) {
+    for (j = i + 1; j < n; j++) {
+      if (!graph.IsVisible(i, j)) {
+        length = -1;
+      } else if (j == (i + 1)) {
+        length = 0;
+      } else {
+        length = Distance(poly->GetPoint(i), poly->GetPoint(j));
+      }
+      rows[i][j].weight = 0;
+      rows[i][j].length = length;
+      columns[j][i].weight = 0;
+      columns[j][i].length = length;
+    }
+  }
+  graph.Clear();
+  TPPL_STATS_TIMER(timer, dptime);
+
+  threads = GetThreadCount(n * n * n / 6);
+  TPPLBarrier barrier(threads);
+
+  TPPLRunThreads(threads, [&](int thread) {
+    long i, j, gap, first, last;
+    long bestvertex;
+    tppl_float minweight;
+
+    // All diagonals spanning gap edges only depend on shorter ones,
+    // and are split evenly among the threads.
+    for (gap = 2; gap < n; gap++) {
+      first = (n - gap) * thread / threads;
+      last = (n - gap) * (thread + 1) / threads;
+      for (i = first; i < last; i++) {
+        j = i + gap;
+        if (rows[i][j].length < 0) {
+          continue;
+        }
+        TPPL_STATS_ADD(numdpstates, 1);
+        bestvertex = GetBestVertex(i, j, rows, columns, &minweight);
+        if (bestvertex == -1) {
+          failed = true;
+          break;
         }
+        rows[i][j].weight = minweight;
+        columns[j][i].weight = minweight;
       }
-      if (bestvertex == -1) {
-        for (i = 1; i < n; i++) {
-          delete[] dpstates[i];
-        }
-        delete[] dpstates;
-
-        return 0;
+      barrier.Wait();
+      if (failed) {
+        break;
       }
-
-      dpstates[j][i].bestvertex = bestvertex;
-      dpstates[j][i].weight = minweight;
     }
+  });
+
+  if (failed) {
+    TPPLDeleteArray(states, size, workspace);
+    TPPLDeleteArray(rows, n, workspace);
+    TPPLDeleteArray(columns, n, workspace);
+    return 0;
   }
 
+  // The best vertices are found again while going through the
+  // optimal diagonals, rather than stored for all of them.
   newdiagonal.index1 = 0;
   newdiagonal.index2 = n - 1;
   diagonals.push_back(newdiagonal);
   while (!diagonals.empty()) {
     diagonal = *(diagonals.begin());
     diagonals.pop_front();
-    bestvertex = dpstates[diagonal.index2][diagonal.index1].bestvertex;
+    bestvertex = GetBestVertex(diagonal.index1, diagonal.index2, rows, columns, &minweight);
     if (bestvertex == -1) {
       ret = 0;
       break;
     }
-    triangle.Triangle(poly->GetPoint(diagonal.index1), poly->GetPoint(bestvertex), poly->GetPoint(diagonal.index2));
-    triangles->push_back(triangle);
+    sink->Add(diagonal.index1, bestvertex, diagonal.index2);
     if (bestvertex > (diagonal.index1 + 1)) {
       newdiagonal.index1 = diagonal.index1;
       newdiagonal.index2 = bestvertex;
@@ -842,46 +2979,105 @@ int TPPLPartition::Triangulate_OPT(TPPLPoly *poly, TPPLPolyList *triangles) {
     }
   }
 
-  for (i = 1; i < n; i++) {
-    delete[] dpstates[i];
-  }
-  delete[] dpstates;
+  TPPLDeleteArray(states, size, workspace);
+  TPPLDeleteArray(rows, n, workspace);
+  TPPLDeleteArray(columns, n, workspace);
 
   return ret;
 }
 
-void TPPLPartition::UpdateState(long a, long b, long w, long i, long j, DPState2 **dpstates) {
-  Diagonal newdiagonal;
-  DiagonalList *pairs = NULL;
-  long w2;
+void TPPLPartition::DiagonalPool::PushFront(DPState2 *state, long index1, long index2) {
+  DiagonalNode *node;
+  long n;
+
+  if (freenodes >= 0) {
+    n = freenodes;
+    freenodes = nodes[n].next;
+  } else {
+    n = (long)nodes.size();
+    if (n >= maxnodes) {
+      exhausted = true;
+      return;
+    }
+    if ((n == (long)nodes.capacity()) && (n > maxnodes / 2)) {
+      nodes.reserve(maxnodes);
+    }
+    nodes.push_back(DiagonalNode());
+  }
+  node = &(nodes[n]);
+  node->index1 = index1;
+  node->index2 = index2;
+  node->previous = -1;
+  node->next = state->firstpair;
+  if (state->firstpair >= 0) {
+    nodes[state->firstpair].previous = n;
+  } else {
+    state->lastpair = n;
+  }
+  state->firstpair = n;
+}
+
+void TPPLPartition::DiagonalPool::PopFront(DPState2 *state) {
+  long n = state->firstpair;
+
+  state->firstpair = nodes[n].next;
+  if (state->firstpair >= 0) {
+    nodes[state->firstpair].previous = -1;
+  } else {
+    state->lastpair = -1;
+  }
+  nodes[n].next = freenodes;
+  freenodes = n;
+}
+
+void TPPLPartition::DiagonalPool::PopBack(DPState2 *state) {
+  long n = state->lastpair;
 
-  w2 = dpstates[a][b].weight;
-  if (w > w2) {
+  state->lastpair = nodes[n].previous;
+  if (state->lastpair >= 0) {
+    nodes[state->lastpair].next = -1;
+  } else {
+    state->firstpair = -1;
+  }
+  nodes[n].next = freenodes;
+  freenodes = n;
+}
+
+void TPPLPartition::DiagonalPool::Clear(DPState2 *state) {
+  if (state->firstpair < 0) {
     return;
   }
+  nodes[state->lastpair].next = freenodes;
+  freenodes = state->firstpair;
+  state->firstpair = -1;
+  state->lastpair = -1;
+}
+
+void TPPLPartition::UpdateState(long a, long b, long w, long i, long j, DPState2 **dpstates, DiagonalPool *pool) {
+  DPState2 *state = &(dpstates[a][b]);
 
-  pairs = &(dpstates[a][b].pairs);
-  newdiagonal.index1 = i;
-  newdiagonal.index2 = j;
+  if (w > state->weight) {
+    return;
+  }
 
-  if (w < w2) {
-    pairs->clear();
-    pairs->push_front(newdiagonal);
-    dpstates[a][b].weight = w;
+  if (w < state->weight) {
+    pool->Clear(state);
+    pool->PushFront(state, i, j);
+    state->weight = w;
   } else {
-    if ((!pairs->empty()) && (i <= pairs->begin()->index1)) {
+    if ((state->firstpair >= 0) && (i <= pool->nodes[state->firstpair].index1)) {
       return;
     }
-    while ((!pairs->empty()) && (pairs->begin()->index2 >= j)) {
-      pairs->pop_front();
+    while ((state->firstpair >= 0) && (pool->nodes[state->firstpair].index2 >= j)) {
+      pool->PopFront(state);
     }
-    pairs->push_front(newdiagonal);
+    pool->PushFront(state, i, j);
   }
 }
 
-void TPPLPartition::TypeA(long i, long j, long k, PartitionVertex *vertices, DPState2 **dpstates) {
-  DiagonalList *pairs = NULL;
-  DiagonalList::iterator iter, lastiter;
+void TPPLPartition::TypeA(long i, long j, long k, PartitionVertex *vertices, DPState2 **dpstates, DiagonalPool *pool) {
+  DiagonalNode *nodes = pool->nodes.data();
+  long iter, lastiter;
   long top;
   long w;
 
@@ -897,33 +3093,30 @@ void TPPLPartition::TypeA(long i, long j, long k, PartitionVertex *vertices, DPS
     w += dpstates[j][k].weight + 1;
   }
   if (j - i > 1) {
-    pairs = &(dpstates[i][j].pairs);
-    iter = pairs->end();
-    lastiter = pairs->end();
-    while (iter != pairs->begin()) {
-      iter--;
-      if (!IsReflex(vertices[iter->index2].p, vertices[j].p, vertices[k].p)) {
+    lastiter = -1;
+    for (iter = dpstates[i][j].lastpair; iter >= 0; iter = nodes[iter].previous) {
+      if (!IsReflex(vertices[nodes[iter].index2].p, vertices[j].p, vertices[k].p)) {
         lastiter = iter;
       } else {
         break;
       }
     }
-    if (lastiter == pairs->end()) {
+    if (lastiter < 0) {
       w++;
     } else {
-      if (IsReflex(vertices[k].p, vertices[i].p, vertices[lastiter->index1].p)) {
+      if (IsReflex(vertices[k].p, vertices[i].p, vertices[nodes[lastiter].index1].p)) {
         w++;
       } else {
-        top = lastiter->index1;
+        top = nodes[lastiter].index1;
       }
     }
   }
-  UpdateState(i, k, w, top, j, dpstates);
+  UpdateState(i, k, w, top, j, dpstates, pool);
 }
 
-void TPPLPartition::TypeB(long i, long j, long k, PartitionVertex *vertices, DPState2 **dpstates) {
-  DiagonalList *pairs = NULL;
-  DiagonalList::iterator iter, lastiter;
+void TPPLPartition::TypeB(long i, long j, long k, PartitionVertex *vertices, DPState2 **dpstates, DiagonalPool *pool) {
+  DiagonalNode *nodes = pool->nodes.data();
+  long iter, lastiter;
   long top;
   long w;
 
@@ -940,56 +3133,87 @@ void TPPLPartition::TypeB(long i, long j, long k, PartitionVertex *vertices, DPS
     w += dpstates[i][j].weight + 1;
   }
   if (k - j > 1) {
-    pairs = &(dpstates[j][k].pairs);
-
-    iter = pairs->begin();
-    if ((!pairs->empty()) && (!IsReflex(vertices[i].p, vertices[j].p, vertices[iter->index1].p))) {
-      lastiter = iter;
-      while (iter != pairs->end()) {
-        if (!IsReflex(vertices[i].p, vertices[j].p, vertices[iter->index1].p)) {
-          lastiter = iter;
-          iter++;
-        } else {
-          break;
-        }
+    lastiter = -1;
+    for (iter = dpstates[j][k].firstpair; iter >= 0; iter = nodes[iter].next) {
+      if (!IsReflex(vertices[i].p, vertices[j].p, vertices[nodes[iter].index1].p)) {
+        lastiter = iter;
+      } else {
+        break;
       }
-      if (IsReflex(vertices[lastiter->index2].p, vertices[k].p, vertices[i].p)) {
+    }
+    if (lastiter < 0) {
+      w++;
+    } else {
+      if (IsReflex(vertices[nodes[lastiter].index2].p, vertices[k].p, vertices[i].p)) {
         w++;
       } else {
-        top = lastiter->index2;
+        top = nodes[lastiter].index2;
       }
-    } else {
-      w++;
     }
   }
-  UpdateState(i, k, w, j, top, dpstates);
+  UpdateState(i, k, w, j, top, dpstates, pool);
+}
+
+// Returns the number of bytes ConvexPartition_OPT needs before the
+// pair lists start to grow, including the visibility graph.
+size_t TPPLPartition::GetConvexPartition_OPTMemory(long numvertices) {
+  size_t n = (size_t)numvertices;
+  return n * (n + 1) / 2 * sizeof(DPState2) + n * sizeof(DPState2 *) +
+          n * sizeof(PartitionVertex) + n * ((n + 63) / 64) * sizeof(uint64_t);
 }
 
 int TPPLPartition::ConvexPartition_OPT(TPPLPoly *poly, TPPLPolyList *parts) {
+  return ConvexPartition_OPT(poly, parts, NULL);
+}
+
+int TPPLPartition::ConvexPartition_OPT(TPPLPoly *poly, TPPLPolyList *parts, bool *optimal) {
+  if (optimal) {
+    *optimal = true;
+  }
   if (!poly->Valid()) {
     return 0;
   }
 
-  TPPLPoint p1, p2, p3, p4;
+  TPPLWorkspaceScope scope(workspace);
+  TPPL_STATS_SCOPE();
   PartitionVertex *vertices = NULL;
+  DPState2 *states = NULL;
   DPState2 **dpstates = NULL;
+  size_t memory = GetConvexPartition_OPTMemory(poly->GetNumPoints());
+  long maxnodes = std::numeric_limits<long>::max();
+  TPPLVisibilityGraph graph;
   long i, j, k, n, gap;
   DiagonalList diagonals, diagonals2;
   Diagonal diagonal, newdiagonal;
-  DiagonalList *pairs = NULL, *pairs2 = NULL;
-  DiagonalList::iterator iter, iter2;
+  DPState2 *state = NULL, *state2 = NULL;
+  DiagonalNode *node = NULL;
   int ret;
   TPPLPoly newpoly;
-  std::vector<long> indices;
-  std::vector<long>::iterator iiter;
+  IndexArray indices;
+  IndexArray::iterator iiter;
   bool ijreal, jkreal;
 
+  // Fall back to Hertel-Mehlhorn if the tables don't fit. Whatever
+  // remains of the limit can be used for the pair lists.
+  if (memorylimit > 0) {
+    if (memory > memorylimit) {
+      if (optimal) {
+        *optimal = false;
+      }
+      return ConvexPartition_HM(poly, parts);
+    }
+    maxnodes = (long)std::min((memorylimit - memory) / sizeof(DiagonalNode), (size_t)maxnodes);
+  }
+  DiagonalPool pool(maxnodes);
+
   n = poly->GetNumPoints();
-  vertices = new PartitionVertex[n];
+  vertices = TPPLNewArray<PartitionVertex>(n, workspace);
 
-  dpstates = new DPState2 *[n];
+  // Only states with i <= j are stored, row i holds j = i .. n - 1.
+  states = TPPLNewArray<DPState2>(n * (n + 1) / 2, workspace);
+  dpstates = TPPLNewArray<DPState2 *>(n, workspace);
   for (i = 0; i < n; i++) {
-    dpstates[i] = new DPState2[n];
+    dpstates[i] = states + i * (n - 1) - i * (i - 1) / 2;
   }
 
   // Initialize vertex information.
@@ -1012,75 +3236,57 @@ int TPPLPartition::ConvexPartition_OPT(TPPLPoly *poly, TPPLPolyList *parts) {
   }
 
   // Initialize states and visibility.
+  if (!GetVisibilityGraph(poly, &graph)) {
+    TPPLDeleteArray(states, n * (n + 1) / 2, workspace);
+    TPPLDeleteArray(dpstates, n, workspace);
+    TPPLDeleteArray(vertices, n, workspace);
+    return 0;
+  }
   for (i = 0; i < (n - 1); i++) {
-    p1 = poly->GetPoint(i);
     for (j = i + 1; j < n; j++) {
-      dpstates[i][j].visible = true;
+      dpstates[i][j].visible = graph.IsVisible(i, j);
+      dpstates[i][j].firstpair = -1;
+      dpstates[i][j].lastpair = -1;
       if (j == i + 1) {
         dpstates[i][j].weight = 0;
       } else {
         dpstates[i][j].weight = 2147483647;
       }
-      if (j != (i + 1)) {
-        p2 = poly->GetPoint(j);
-
-        // Visibility check.
-        if (!InCone(&vertices[i], p2)) {
-          dpstates[i][j].visible = false;
-          continue;
-        }
-        if (!InCone(&vertices[j], p1)) {
-          dpstates[i][j].visible = false;
-          continue;
-        }
-
-        for (k = 0; k < n; k++) {
-          p3 = poly->GetPoint(k);
-          if (k == (n - 1)) {
-            p4 = poly->GetPoint(0);
-          } else {
-            p4 = poly->GetPoint(k + 1);
-          }
-          if (Intersects(p1, p2, p3, p4)) {
-            dpstates[i][j].visible = false;
-            break;
-          }
-        }
-      }
     }
   }
+  graph.Clear();
+  TPPL_STATS_TIMER(timer, dptime);
   for (i = 0; i < (n - 2); i++) {
     j = i + 2;
     if (dpstates[i][j].visible) {
       dpstates[i][j].weight = 0;
-      newdiagonal.index1 = i + 1;
-      newdiagonal.index2 = i + 1;
-      dpstates[i][j].pairs.push_back(newdiagonal);
+      pool.PushFront(&(dpstates[i][j]), i + 1, i + 1);
     }
   }
 
   dpstates[0][n - 1].visible = true;
   vertices[0].isConvex = false; // By convention.
 
-  for (gap = 3; gap < n; gap++) {
+  for (gap = 3; (gap < n) && (!pool.exhausted); gap++) {
     for (i = 0; i < n - gap; i++) {
       if (vertices[i].isConvex) {
         continue;
       }
       k = i + gap;
       if (dpstates[i][k].visible) {
+        TPPL_STATS_ADD(numdpstates, 1);
         if (!vertices[k].isConvex) {
           for (j = i + 1; j < k; j++) {
-            TypeA(i, j, k, vertices, dpstates);
+            TypeA(i, j, k, vertices, dpstates, &pool);
           }
         } else {
           for (j = i + 1; j < (k - 1); j++) {
             if (vertices[j].isConvex) {
               continue;
             }
-            TypeA(i, j, k, vertices, dpstates);
+            TypeA(i, j, k, vertices, dpstates, &pool);
           }
-          TypeA(i, k - 1, k, vertices, dpstates);
+          TypeA(i, k - 1, k, vertices, dpstates, &pool);
         }
       }
     }
@@ -1090,16 +3296,29 @@ int TPPLPartition::ConvexPartition_OPT(TPPLPoly *poly, TPPLPolyList *parts) {
       }
       i = k - gap;
       if ((vertices[i].isConvex) && (dpstates[i][k].visible)) {
-        TypeB(i, i + 1, k, vertices, dpstates);
+        TPPL_STATS_ADD(numdpstates, 1);
+        TypeB(i, i + 1, k, vertices, dpstates, &pool);
         for (j = i + 2; j < k; j++) {
           if (vertices[j].isConvex) {
             continue;
           }
-          TypeB(i, j, k, vertices, dpstates);
+          TypeB(i, j, k, vertices, dpstates, &pool);
         }
       }
     }
   }
+  TPPL_STATS_STOP(timer);
+
+  if (pool.exhausted) {
+    TPPLDeleteArray(states, n * (n + 1) / 2, workspace);
+    TPPLDeleteArray(dpstates, n, workspace);
+    TPPLDeleteArray(vertices, n, workspace);
+    DiagonalNodeArray().swap(pool.nodes);
+    if (optimal) {
+      *optimal = false;
+    }
+    return ConvexPartition_HM(poly, parts);
+  }
 
   // Recover solution.
   ret = 1;
@@ -1112,30 +3331,27 @@ int TPPLPartition::ConvexPartition_OPT(TPPLPoly *poly, TPPLPolyList *parts) {
     if ((diagonal.index2 - diagonal.index1) <= 1) {
       continue;
     }
-    pairs = &(dpstates[diagonal.index1][diagonal.index2].pairs);
-    if (pairs->empty()) {
+    state = &(dpstates[diagonal.index1][diagonal.index2]);
+    if (state->firstpair < 0) {
       ret = 0;
       break;
     }
     if (!vertices[diagonal.index1].isConvex) {
-      iter = pairs->end();
-      iter--;
-      j = iter->index2;
+      node = &(pool.nodes[state->lastpair]);
+      j = node->index2;
       newdiagonal.index1 = j;
       newdiagonal.index2 = diagonal.index2;
       diagonals.push_front(newdiagonal);
       if ((j - diagonal.index1) > 1) {
-        if (iter->index1 != iter->index2) {
-          pairs2 = &(dpstates[diagonal.index1][j].pairs);
+        if (node->index1 != node->index2) {
+          state2 = &(dpstates[diagonal.index1][j]);
           while (1) {
-            if (pairs2->empty()) {
+            if (state2->lastpair < 0) {
               ret = 0;
               break;
             }
-            iter2 = pairs2->end();
-            iter2--;
-            if (iter->index1 != iter2->index1) {
-              pairs2->pop_back();
+            if (node->index1 != pool.nodes[state2->lastpair].index1) {
+              pool.PopBack(state2);
             } else {
               break;
             }
@@ -1149,22 +3365,21 @@ int TPPLPartition::ConvexPartition_OPT(TPPLPoly *poly, TPPLPolyList *parts) {
         diagonals.push_front(newdiagonal);
       }
     } else {
-      iter = pairs->begin();
-      j = iter->index1;
+      node = &(pool.nodes[state->firstpair]);
+      j = node->index1;
       newdiagonal.index1 = diagonal.index1;
       newdiagonal.index2 = j;
       diagonals.push_front(newdiagonal);
       if ((diagonal.index2 - j) > 1) {
-        if (iter->index1 != iter->index2) {
-          pairs2 = &(dpstates[j][diagonal.index2].pairs);
+        if (node->index1 != node->index2) {
+          state2 = &(dpstates[j][diagonal.index2]);
           while (1) {
-            if (pairs2->empty()) {
+            if (state2->firstpair < 0) {
               ret = 0;
               break;
             }
-            iter2 = pairs2->begin();
-            if (iter->index2 != iter2->index2) {
-              pairs2->pop_front();
+            if (node->index2 != pool.nodes[state2->firstpair].index2) {
+              pool.PopFront(state2);
             } else {
               break;
             }
@@ -1181,11 +3396,9 @@ int TPPLPartition::ConvexPartition_OPT(TPPLPoly *poly, TPPLPolyList *parts) {
   }
 
   if (ret == 0) {
-    for (i = 0; i < n; i++) {
-      delete[] dpstates[i];
-    }
-    delete[] dpstates;
-    delete[] vertices;
+    TPPLDeleteArray(states, n * (n + 1) / 2, workspace);
+    TPPLDeleteArray(dpstates, n, workspace);
+    TPPLDeleteArray(vertices, n, workspace);
 
     return ret;
   }
@@ -1214,18 +3427,17 @@ int TPPLPartition::ConvexPartition_OPT(TPPLPoly *poly, TPPLPolyList *parts) {
       }
       ijreal = true;
       jkreal = true;
-      pairs = &(dpstates[diagonal.index1][diagonal.index2].pairs);
+      state = &(dpstates[diagonal.index1][diagonal.index2]);
       if (!vertices[diagonal.index1].isConvex) {
-        iter = pairs->end();
-        iter--;
-        j = iter->index2;
-        if (iter->index1 != iter->index2) {
+        node = &(pool.nodes[state->lastpair]);
+        j = node->index2;
+        if (node->index1 != node->index2) {
           ijreal = false;
         }
       } else {
-        iter = pairs->begin();
-        j = iter->index1;
-        if (iter->index1 != iter->index2) {
+        node = &(pool.nodes[state->firstpair]);
+        j = node->index1;
+        if (node->index1 != node->index2) {
           jkreal = false;
         }
       }
@@ -1256,14 +3468,12 @@ int TPPLPartition::ConvexPartition_OPT(TPPLPoly *poly, TPPLPolyList *parts) {
       newpoly[k] = vertices[*iiter].p;
       k++;
     }
-    parts->push_back(newpoly);
+    parts->push_back(std::move(newpoly));
   }
 
-  for (i = 0; i < n; i++) {
-    delete[] dpstates[i];
-  }
-  delete[] dpstates;
-  delete[] vertices;
+  TPPLDeleteArray(states, n * (n + 1) / 2, workspace);
+  TPPLDeleteArray(dpstates, n, workspace);
+  TPPLDeleteArray(vertices, n, workspace);
 
   return ret;
 }
@@ -1277,13 +3487,43 @@ int TPPLPartition::ConvexPartition_OPT(TPPLPoly *poly, TPPLPolyList *parts) {
 // "Computational Geometry: Algorithms and Applications"
 // by Mark de Berg, Otfried Cheong, Marc van Kreveld, and Mark Overmars.
 int TPPLPartition::MonotonePartition(TPPLPolyList *inpolys, TPPLPolyList *monotonePolys) {
+  TPPLMonotonePieces localpieces;
+  TPPLMonotonePieces *pieces = workspace ? &(workspace->pieces) : &localpieces;
+  TPPLPoly mpoly;
+  TPPLPoint *points = NULL;
+  long *offsets = NULL, *indices = NULL;
+  long i, j;
+  TPPL_STATS_SCOPE();
+
+  if (!MonotonePartition(inpolys, pieces)) {
+    return 0;
+  }
+
+  // Return result.
+  points = pieces->GetPoints();
+  offsets = pieces->GetOffsets();
+  indices = pieces->GetIndices();
+  for (i = 0; i < pieces->GetNumPieces(); i++) {
+    mpoly.Init(pieces->GetNumVertices(i));
+    for (j = offsets[i]; j < offsets[i + 1]; j++) {
+      mpoly[j - offsets[i]] = points[indices[j]];
+    }
+    monotonePolys->push_back(std::move(mpoly));
+  }
+
+  return 1;
+}
+
+int TPPLPartition::MonotonePartition(TPPLPolyList *inpolys, TPPLMonotonePieces *pieces) {
+  TPPLWorkspaceScope scope(workspace);
+  TPPL_STATS_SCOPE();
+  TPPL_STATS_TIMER(timer, sweeptime);
   TPPLPolyList::iterator iter;
   MonotoneVertex *vertices = NULL;
   long i, numvertices, vindex, vindex2, newnumvertices, maxnumvertices;
   long polystartindex, polyendindex;
   TPPLPoly *poly = NULL;
   MonotoneVertex *v = NULL, *v2 = NULL, *vprev = NULL, *vnext = NULL;
-  ScanLineEdge newedge;
   bool error = false;
 
   numvertices = 0;
@@ -1295,7 +3535,7 @@ int TPPLPartition::MonotonePartition(TPPLPolyList *inpolys, TPPLPolyList *monoto
   }
 
   maxnumvertices = numvertices * 3;
-  vertices = new MonotoneVertex[maxnumvertices];
+  vertices = TPPLNewArray<MonotoneVertex>(maxnumvertices, workspace);
   newnumvertices = numvertices;
 
   polystartindex = 0;
@@ -1304,6 +3544,7 @@ int TPPLPartition::MonotonePartition(TPPLPolyList *inpolys, TPPLPolyList *monoto
     polyendindex = polystartindex + poly->GetNumPoints() - 1;
     for (i = 0; i < poly->GetNumPoints(); i++) {
       vertices[i + polystartindex].p = poly->GetPoint(i);
+      vertices[i + polystartindex].index = i + polystartindex;
       if (i == 0) {
         vertices[i + polystartindex].previous = polyendindex;
       } else {
@@ -1319,14 +3560,14 @@ int TPPLPartition::MonotonePartition(TPPLPolyList *inpolys, TPPLPolyList *monoto
   }
 
   // Construct the priority queue.
-  long *priority = new long[numvertices];
+  long *priority = TPPLNewArray<long>(numvertices, workspace);
   for (i = 0; i < numvertices; i++) {
     priority[i] = i;
   }
   std::sort(priority, &(priority[numvertices]), VertexSorter(vertices));
 
   // Determine vertex types.
-  TPPLVertexType *vertextypes = new TPPLVertexType[maxnumvertices];
+  TPPLVertexType *vertextypes = TPPLNewArray<TPPLVertexType>(maxnumvertices, workspace);
   for (i = 0; i < numvertices; i++) {
     v = &(vertices[i]);
     vprev = &(vertices[v->previous]);
@@ -1350,20 +3591,18 @@ int TPPLPartition::MonotonePartition(TPPLPolyList *inpolys, TPPLPolyList *monoto
   }
 
   // Helpers.
-  long *helpers = new long[maxnumvertices];
+  long *helpers = TPPLNewArray<long>(maxnumvertices, workspace);
 
   // Binary search tree that holds edges intersecting the scanline.
-  // Note that while set doesn't actually have to be implemented as
-  // a tree, complexity requirements for operations are the same as
-  // for the balanced binary search tree.
-  std::set<ScanLineEdge> edgeTree;
-  // Store iterators to the edge tree elements.
+  // Every edge is inserted at its upper vertex, so the index of that
+  // vertex is used as the tree node.
+  ScanLineTree edgeTree(maxnumvertices, workspace);
+  // Tree node of the edge starting at each vertex, -1 if none.
   // This makes deleting existing edges much faster.
-  std::set<ScanLineEdge>::iterator *edgeTreeIterators, edgeIter;
-  edgeTreeIterators = new std::set<ScanLineEdge>::iterator[maxnumvertices];
-  std::pair<std::set<ScanLineEdge>::iterator, bool> edgeTreeRet;
-  for (i = 0; i < numvertices; i++) {
-    edgeTreeIterators[i] = edgeTree.end();
+  long *edgeTreeNodes = TPPLNewArray<long>(maxnumvertices, workspace);
+  long edgeNode;
+  for (i = 0; i < maxnumvertices; i++) {
+    edgeTreeNodes[i] = -1;
   }
 
   // For each vertex.
@@ -1380,16 +3619,13 @@ int TPPLPartition::MonotonePartition(TPPLPolyList *inpolys, TPPLPolyList *monoto
     switch (vertextypes[vindex]) {
       case TPPL_VERTEXTYPE_START:
         // Insert e_i in T and set helper(e_i) to v_i.
-        newedge.p1 = v->p;
-        newedge.p2 = vertices[v->next].p;
-        newedge.index = vindex;
-        edgeTreeRet = edgeTree.insert(newedge);
-        edgeTreeIterators[vindex] = edgeTreeRet.first;
+        edgeTree.Insert(vindex, v->p, vertices[v->next].p);
+        edgeTreeNodes[vindex] = vindex;
         helpers[vindex] = vindex;
         break;
 
       case TPPL_VERTEXTYPE_END:
-        if (edgeTreeIterators[v->previous] == edgeTree.end()) {
+        if (edgeTreeNodes[v->previous] < 0) {
           error = true;
           break;
         }
@@ -1397,40 +3633,35 @@ int TPPLPartition::MonotonePartition(TPPLPolyList *inpolys, TPPLPolyList *monoto
         if (vertextypes[helpers[v->previous]] == TPPL_VERTEXTYPE_MERGE) {
           // Insert the diagonal connecting vi to helper(e_i - 1) in D.
           AddDiagonal(vertices, &newnumvertices, vindex, helpers[v->previous],
-                  vertextypes, edgeTreeIterators, &edgeTree, helpers);
+                  vertextypes, edgeTreeNodes, &edgeTree, helpers);
         }
         // Delete e_i - 1 from T
-        edgeTree.erase(edgeTreeIterators[v->previous]);
+        edgeTree.Remove(edgeTreeNodes[v->previous]);
+        edgeTreeNodes[v->previous] = -1;
         break;
 
       case TPPL_VERTEXTYPE_SPLIT:
         // Search in T to find the edge e_j directly left of v_i.
-        newedge.p1 = v->p;
-        newedge.p2 = v->p;
-        edgeIter = edgeTree.lower_bound(newedge);
-        if (edgeIter == edgeTree.begin()) {
+        edgeNode = edgeTree.FindLeft(v->p);
+        if (edgeNode < 0) {
           error = true;
           break;
         }
-        edgeIter--;
         // Insert the diagonal connecting vi to helper(e_j) in D.
-        AddDiagonal(vertices, &newnumvertices, vindex, helpers[edgeIter->index],
-                vertextypes, edgeTreeIterators, &edgeTree, helpers);
+        AddDiagonal(vertices, &newnumvertices, vindex, helpers[edgeTree.edges[edgeNode].index],
+                vertextypes, edgeTreeNodes, &edgeTree, helpers);
         vindex2 = newnumvertices - 2;
         v2 = &(vertices[vindex2]);
         // helper(e_j) in v_i.
-        helpers[edgeIter->index] = vindex;
+        helpers[edgeTree.edges[edgeNode].index] = vindex;
         // Insert e_i in T and set helper(e_i) to v_i.
-        newedge.p1 = v2->p;
-        newedge.p2 = vertices[v2->next].p;
-        newedge.index = vindex2;
-        edgeTreeRet = edgeTree.insert(newedge);
-        edgeTreeIterators[vindex2] = edgeTreeRet.first;
+        edgeTree.Insert(vindex2, v2->p, vertices[v2->next].p);
+        edgeTreeNodes[vindex2] = vindex2;
         helpers[vindex2] = vindex2;
         break;
 
       case TPPL_VERTEXTYPE_MERGE:
-        if (edgeTreeIterators[v->previous] == edgeTree.end()) {
+        if (edgeTreeNodes[v->previous] < 0) {
           error = true;
           break;
         }
@@ -1438,34 +3669,32 @@ int TPPLPartition::MonotonePartition(TPPLPolyList *inpolys, TPPLPolyList *monoto
         if (vertextypes[helpers[v->previous]] == TPPL_VERTEXTYPE_MERGE) {
           // Insert the diagonal connecting vi to helper(e_i - 1) in D.
           AddDiagonal(vertices, &newnumvertices, vindex, helpers[v->previous],
-                  vertextypes, edgeTreeIterators, &edgeTree, helpers);
+                  vertextypes, edgeTreeNodes, &edgeTree, helpers);
           vindex2 = newnumvertices - 2;
         }
         // Delete e_i - 1 from T.
-        edgeTree.erase(edgeTreeIterators[v->previous]);
+        edgeTree.Remove(edgeTreeNodes[v->previous]);
+        edgeTreeNodes[v->previous] = -1;
         // Search in T to find the edge e_j directly left of v_i.
-        newedge.p1 = v->p;
-        newedge.p2 = v->p;
-        edgeIter = edgeTree.lower_bound(newedge);
-        if (edgeIter == edgeTree.begin()) {
+        edgeNode = edgeTree.FindLeft(v->p);
+        if (edgeNode < 0) {
           error = true;
           break;
         }
-        edgeIter--;
         // If helper(e_j) is a merge vertex.
-        if (vertextypes[helpers[edgeIter->index]] == TPPL_VERTEXTYPE_MERGE) {
+        if (vertextypes[helpers[edgeTree.edges[edgeNode].index]] == TPPL_VERTEXTYPE_MERGE) {
           // Insert the diagonal connecting v_i to helper(e_j) in D.
-          AddDiagonal(vertices, &newnumvertices, vindex2, helpers[edgeIter->index],
-                  vertextypes, edgeTreeIterators, &edgeTree, helpers);
+          AddDiagonal(vertices, &newnumvertices, vindex2, helpers[edgeTree.edges[edgeNode].index],
+                  vertextypes, edgeTreeNodes, &edgeTree, helpers);
         }
         // helper(e_j) <- v_i
-        helpers[edgeIter->index] = vindex2;
+        helpers[edgeTree.edges[edgeNode].index] = vindex2;
         break;
 
       case TPPL_VERTEXTYPE_REGULAR:
         // If the interior of P lies to the right of v_i.
         if (Below(v->p, vertices[v->previous].p)) {
-          if (edgeTreeIterators[v->previous] == edgeTree.end()) {
+          if (edgeTreeNodes[v->previous] < 0) {
             error = true;
             break;
           }
@@ -1473,37 +3702,32 @@ int TPPLPartition::MonotonePartition(TPPLPolyList *inpolys, TPPLPolyList *monoto
           if (vertextypes[helpers[v->previous]] == TPPL_VERTEXTYPE_MERGE) {
             // Insert the diagonal connecting v_i to helper(e_i - 1) in D.
             AddDiagonal(vertices, &newnumvertices, vindex, helpers[v->previous],
-                    vertextypes, edgeTreeIterators, &edgeTree, helpers);
+                    vertextypes, edgeTreeNodes, &edgeTree, helpers);
             vindex2 = newnumvertices - 2;
             v2 = &(vertices[vindex2]);
           }
           // Delete e_i - 1 from T.
-          edgeTree.erase(edgeTreeIterators[v->previous]);
+          edgeTree.Remove(edgeTreeNodes[v->previous]);
+          edgeTreeNodes[v->previous] = -1;
           // Insert e_i in T and set helper(e_i) to v_i.
-          newedge.p1 = v2->p;
-          newedge.p2 = vertices[v2->next].p;
-          newedge.index = vindex2;
-          edgeTreeRet = edgeTree.insert(newedge);
-          edgeTreeIterators[vindex2] = edgeTreeRet.first;
+          edgeTree.Insert(vindex2, v2->p, vertices[v2->next].p);
+          edgeTreeNodes[vindex2] = vindex2;
           helpers[vindex2] = vindex;
         } else {
           // Search in T to find the edge e_j directly left of v_i.
-          newedge.p1 = v->p;
-          newedge.p2 = v->p;
-          edgeIter = edgeTree.lower_bound(newedge);
-          if (edgeIter == edgeTree.begin()) {
+          edgeNode = edgeTree.FindLeft(v->p);
+          if (edgeNode < 0) {
             error = true;
             break;
           }
-          edgeIter--;
           // If helper(e_j) is a merge vertex.
-          if (vertextypes[helpers[edgeIter->index]] == TPPL_VERTEXTYPE_MERGE) {
+          if (vertextypes[helpers[edgeTree.edges[edgeNode].index]] == TPPL_VERTEXTYPE_MERGE) {
             // Insert the diagonal connecting v_i to helper(e_j) in D.
-            AddDiagonal(vertices, &newnumvertices, vindex, helpers[edgeIter->index],
-                    vertextypes, edgeTreeIterators, &edgeTree, helpers);
+            AddDiagonal(vertices, &newnumvertices, vindex, helpers[edgeTree.edges[edgeNode].index],
+                    vertextypes, edgeTreeNodes, &edgeTree, helpers);
           }
           // helper(e_j) <- v_i.
-          helpers[edgeIter->index] = vindex;
+          helpers[edgeTree.edges[edgeNode].index] = vindex;
         }
         break;
     }
@@ -1512,48 +3736,57 @@ int TPPLPartition::MonotonePartition(TPPLPolyList *inpolys, TPPLPolyList *monoto
       break;
   }
 
-  char *used = new char[newnumvertices];
+  char *used = TPPLNewArray<char>(newnumvertices, workspace);
   memset(used, 0, newnumvertices * sizeof(char));
 
   if (!error) {
-    // Return result.
-    long size;
-    TPPLPoly mpoly;
+    // Return result. Every vertex belongs to exactly one piece, so only
+    // the pieces need to be counted first.
+    long numpieces, size;
+    long *offsets = NULL, *indices = NULL;
+    numpieces = 0;
     for (i = 0; i < newnumvertices; i++) {
       if (used[i]) {
         continue;
       }
-      v = &(vertices[i]);
-      vnext = &(vertices[v->next]);
-      size = 1;
-      while (vnext != v) {
-        vnext = &(vertices[vnext->next]);
-        size++;
-      }
-      mpoly.Init(size);
-      v = &(vertices[i]);
-      mpoly[0] = v->p;
-      vnext = &(vertices[v->next]);
-      size = 1;
+      numpieces++;
       used[i] = 1;
-      used[v->next] = 1;
-      while (vnext != v) {
-        mpoly[size] = vnext->p;
-        used[vnext->next] = 1;
-        vnext = &(vertices[vnext->next]);
-        size++;
+      for (vindex = vertices[i].next; vindex != i; vindex = vertices[vindex].next) {
+        used[vindex] = 1;
+      }
+    }
+    pieces->Init(numvertices, numpieces, newnumvertices);
+    for (i = 0; i < numvertices; i++) {
+      pieces->GetPoints()[i] = vertices[i].p;
+    }
+    offsets = pieces->GetOffsets();
+    indices = pieces->GetIndices();
+    memset(used, 0, newnumvertices * sizeof(char));
+    numpieces = 0;
+    size = 0;
+    for (i = 0; i < newnumvertices; i++) {
+      if (used[i]) {
+        continue;
       }
-      monotonePolys->push_back(mpoly);
+      offsets[numpieces] = size;
+      numpieces++;
+      vindex = i;
+      do {
+        used[vindex] = 1;
+        indices[size] = vertices[vindex].index;
+        size++;
+        vindex = vertices[vindex].next;
+      } while (vindex != i);
     }
   }
 
   // Cleanup.
-  delete[] vertices;
-  delete[] priority;
-  delete[] vertextypes;
-  delete[] edgeTreeIterators;
-  delete[] helpers;
-  delete[] used;
+  TPPLDeleteArray(vertices, maxnumvertices, workspace);
+  TPPLDeleteArray(priority, numvertices, workspace);
+  TPPLDeleteArray(vertextypes, maxnumvertices, workspace);
+  TPPLDeleteArray(edgeTreeNodes, maxnumvertices, workspace);
+  TPPLDeleteArray(helpers, maxnumvertices, workspace);
+  TPPLDeleteArray(used, newnumvertices, workspace);
 
   if (error) {
     return 0;
@@ -1564,8 +3797,8 @@ int TPPLPartition::MonotonePartition(TPPLPolyList *inpolys, TPPLPolyList *monoto
 
 // Adds a diagonal to the doubly-connected list of vertices.
 void TPPLPartition::AddDiagonal(MonotoneVertex *vertices, long *numvertices, long index1, long index2,
-        TPPLVertexType *vertextypes, std::set<ScanLineEdge>::iterator *edgeTreeIterators,
-        std::set<ScanLineEdge> *edgeTree, long *helpers) {
+        TPPLVertexType *vertextypes, long *edgeTreeNodes,
+        ScanLineTree *edgeTree, long *helpers) {
   long newindex1, newindex2;
 
   newindex1 = *numvertices;
@@ -1574,7 +3807,9 @@ void TPPLPartition::AddDiagonal(MonotoneVertex *vertices, long *numvertices, lon
   (*numvertices)++;
 
   vertices[newindex1].p = vertices[index1].p;
+  vertices[newindex1].index = vertices[index1].index;
   vertices[newindex2].p = vertices[index2].p;
+  vertices[newindex2].index = vertices[index2].index;
 
   vertices[newindex2].next = vertices[index2].next;
   vertices[newindex1].next = vertices[index1].next;
@@ -1590,16 +3825,16 @@ void TPPLPartition::AddDiagonal(MonotoneVertex *vertices, long *numvertices, lon
 
   // Update all relevant structures.
   vertextypes[newindex1] = vertextypes[index1];
-  edgeTreeIterators[newindex1] = edgeTreeIterators[index1];
+  edgeTreeNodes[newindex1] = edgeTreeNodes[index1];
   helpers[newindex1] = helpers[index1];
-  if (edgeTreeIterators[newindex1] != edgeTree->end()) {
-    edgeTreeIterators[newindex1]->index = newindex1;
+  if (edgeTreeNodes[newindex1] >= 0) {
+    edgeTree->edges[edgeTreeNodes[newindex1]].index = newindex1;
   }
   vertextypes[newindex2] = vertextypes[index2];
-  edgeTreeIterators[newindex2] = edgeTreeIterators[index2];
+  edgeTreeNodes[newindex2] = edgeTreeNodes[index2];
   helpers[newindex2] = helpers[index2];
-  if (edgeTreeIterators[newindex2] != edgeTree->end()) {
-    edgeTreeIterators[newindex2]->index = newindex2;
+  if (edgeTreeNodes[newindex2] >= 0) {
+    edgeTree->edges[edgeTreeNodes[newindex2]].index = newindex2;
   }
 }
 
@@ -1626,60 +3861,198 @@ bool TPPLPartition::VertexSorter::operator()(long index1, long index2) {
   return false;
 }
 
-bool TPPLPartition::ScanLineEdge::IsConvex(const TPPLPoint &p1, const TPPLPoint &p2, const TPPLPoint &p3) const {
-  tppl_float tmp;
-  tmp = (p3.y - p1.y) * (p2.x - p1.x) - (p3.x - p1.x) * (p2.y - p1.y);
-  if (tmp > 0) {
+bool TPPLPartition::ScanLineEdge::IsConvex(const TPPLPoint &p) const {
+  TPPL_STATS_ADD(numconvextests, 1);
+  if (TPPLOrient2D(p1, p2, p) > 0) {
     return 1;
   }
 
   return 0;
 }
 
-bool TPPLPartition::ScanLineEdge::operator<(const ScanLineEdge &other) const {
+bool TPPLPartition::ScanLineEdge::IsLeftOf(const ScanLineEdge &other) const {
   if (other.p1.y == other.p2.y) {
     if (p1.y == p2.y) {
       return (p1.y < other.p1.y);
     }
-    return IsConvex(p1, p2, other.p1);
+    return IsConvex(other.p1);
   } else if (p1.y == p2.y) {
-    return !IsConvex(other.p1, other.p2, p1);
+    return !other.IsConvex(p1);
   } else if (p1.y < other.p1.y) {
-    return !IsConvex(other.p1, other.p2, p1);
+    // If the edge starts on the other one, its lower end decides.
+    if (TPPLOrient2D(other.p1, other.p2, p1) == 0) {
+      return !other.IsConvex(p2);
+    }
+    return !other.IsConvex(p1);
+  } else {
+    if (TPPLOrient2D(p1, p2, other.p1) == 0) {
+      return IsConvex(other.p2);
+    }
+    return IsConvex(other.p1);
+  }
+}
+
+bool TPPLPartition::ScanLineEdge::IsLeftOf(const TPPLPoint &p) const {
+  if (p1.y == p2.y) {
+    return (p1.y < p.y);
+  }
+  return IsConvex(p);
+}
+
+TPPLPartition::ScanLineTree::ScanLineTree(long maxedges, TPPLWorkspace *workspace) {
+  this->maxedges = maxedges;
+  this->workspace = workspace;
+  edges = TPPLNewArray<ScanLineEdge>(maxedges, workspace);
+  root = -1;
+}
+
+TPPLPartition::ScanLineTree::~ScanLineTree() {
+  TPPLDeleteArray(edges, maxedges, workspace);
+}
+
+void TPPLPartition::ScanLineTree::Rotate(long e) {
+  ScanLineEdge *edge = &(edges[e]);
+  long p = edge->parent;
+  ScanLineEdge *parent = &(edges[p]);
+  long g = parent->parent;
+
+  if (parent->left == e) {
+    parent->left = edge->right;
+    if (edge->right >= 0) {
+      edges[edge->right].parent = p;
+    }
+    edge->right = p;
+  } else {
+    parent->right = edge->left;
+    if (edge->left >= 0) {
+      edges[edge->left].parent = p;
+    }
+    edge->left = p;
+  }
+  parent->parent = e;
+  edge->parent = g;
+  if (g < 0) {
+    root = e;
+  } else if (edges[g].left == p) {
+    edges[g].left = e;
+  } else {
+    edges[g].right = e;
+  }
+}
+
+void TPPLPartition::ScanLineTree::Insert(long e, const TPPLPoint &p1, const TPPLPoint &p2) {
+  ScanLineEdge *edge = &(edges[e]);
+  long n, parent;
+  uint32_t h;
+
+  TPPL_STATS_ADD(numsweepoperations, 1);
+  edge->index = e;
+  edge->p1 = p1;
+  edge->p2 = p2;
+
+  // Priorities only need to look random, a hash of e keeps the
+  // results reproducible.
+  h = (uint32_t)e * 2654435761u;
+  h ^= h >> 16;
+  edge->priority = h;
+  edge->left = -1;
+  edge->right = -1;
+
+  parent = -1;
+  n = root;
+  while (n >= 0) {
+    parent = n;
+    if (edge->IsLeftOf(edges[n])) {
+      n = edges[n].left;
+    } else {
+      n = edges[n].right;
+    }
+  }
+  edge->parent = parent;
+  if (parent < 0) {
+    root = e;
+  } else if (edge->IsLeftOf(edges[parent])) {
+    edges[parent].left = e;
+  } else {
+    edges[parent].right = e;
+  }
+
+  while ((edge->parent >= 0) && (edges[edge->parent].priority < edge->priority)) {
+    Rotate(e);
+  }
+}
+
+void TPPLPartition::ScanLineTree::Remove(long e) {
+  ScanLineEdge *edge = &(edges[e]);
+  long child;
+
+  TPPL_STATS_ADD(numsweepoperations, 1);
+  // Rotate the edge down to a leaf.
+  while ((edge->left >= 0) || (edge->right >= 0)) {
+    if (edge->left < 0) {
+      child = edge->right;
+    } else if (edge->right < 0) {
+      child = edge->left;
+    } else if (edges[edge->left].priority > edges[edge->right].priority) {
+      child = edge->left;
+    } else {
+      child = edge->right;
+    }
+    Rotate(child);
+  }
+
+  if (edge->parent < 0) {
+    root = -1;
+  } else if (edges[edge->parent].left == e) {
+    edges[edge->parent].left = -1;
   } else {
-    return IsConvex(p1, p2, other.p1);
+    edges[edge->parent].right = -1;
+  }
+}
+
+long TPPLPartition::ScanLineTree::FindLeft(const TPPLPoint &p) {
+  long n, left;
+
+  TPPL_STATS_ADD(numsweepoperations, 1);
+  left = -1;
+  n = root;
+  while (n >= 0) {
+    if (edges[n].IsLeftOf(p)) {
+      left = n;
+      n = edges[n].right;
+    } else {
+      n = edges[n].left;
+    }
   }
+  return left;
 }
 
 // Triangulates monotone polygon.
 // Time complexity: O(n)
 // Space complexity: O(n)
-int TPPLPartition::TriangulateMonotone(TPPLPoly *inPoly, TPPLPolyList *triangles) {
-  if (!inPoly->Valid()) {
+int TPPLPartition::TriangulateMonotone(TPPLPoint *points, long *indices, long numpoints,
+        long *scratch, TriangleSink *sink) {
+  if (numpoints < 3) {
     return 0;
   }
 
   long i, i2, j, topindex, bottomindex, leftindex, rightindex, vindex;
-  TPPLPoint *points = NULL;
-  long numpoints;
-  TPPLPoly triangle;
 
-  numpoints = inPoly->GetNumPoints();
-  points = inPoly->GetPoints();
+  sink->points = points;
 
   // Trivial case.
   if (numpoints == 3) {
-    triangles->push_back(*inPoly);
+    sink->Add(indices[0], indices[1], indices[2]);
     return 1;
   }
 
   topindex = 0;
   bottomindex = 0;
   for (i = 1; i < numpoints; i++) {
-    if (Below(points[i], points[bottomindex])) {
+    if (Below(points[indices[i]], points[indices[bottomindex]])) {
       bottomindex = i;
     }
-    if (Below(points[topindex], points[i])) {
+    if (Below(points[indices[topindex]], points[indices[i]])) {
       topindex = i;
     }
   }
@@ -1691,7 +4064,7 @@ int TPPLPartition::TriangulateMonotone(TPPLPoly *inPoly, TPPLPolyList *triangles
     if (i2 >= numpoints) {
       i2 = 0;
     }
-    if (!Below(points[i2], points[i])) {
+    if (!Below(points[indices[i2]], points[indices[i]])) {
       return 0;
     }
     i = i2;
@@ -1702,14 +4075,14 @@ int TPPLPartition::TriangulateMonotone(TPPLPoly *inPoly, TPPLPolyList *triangles
     if (i2 >= numpoints) {
       i2 = 0;
     }
-    if (!Below(points[i], points[i2])) {
+    if (!Below(points[indices[i]], points[indices[i2]])) {
       return 0;
     }
     i = i2;
   }
 
-  char *vertextypes = new char[numpoints];
-  long *priority = new long[numpoints];
+  long *vertextypes = scratch;
+  long *priority = scratch + numpoints;
 
   // Merge left and right vertex chains.
   priority[0] = topindex;
@@ -1738,7 +4111,7 @@ int TPPLPartition::TriangulateMonotone(TPPLPoly *inPoly, TPPLPolyList *triangles
       }
       vertextypes[priority[i]] = 1;
     } else {
-      if (Below(points[leftindex], points[rightindex])) {
+      if (Below(points[indices[leftindex]], points[indices[rightindex]])) {
         priority[i] = rightindex;
         rightindex--;
         if (rightindex < 0) {
@@ -1758,7 +4131,7 @@ int TPPLPartition::TriangulateMonotone(TPPLPoly *inPoly, TPPLPolyList *triangles
   priority[i] = bottomindex;
   vertextypes[bottomindex] = 0;
 
-  long *stack = new long[numpoints];
+  long *stack = scratch + 2 * numpoints;
   long stackptr = 0;
 
   stack[0] = priority[0];
@@ -1771,11 +4144,10 @@ int TPPLPartition::TriangulateMonotone(TPPLPoly *inPoly, TPPLPolyList *triangles
     if (vertextypes[vindex] != vertextypes[stack[stackptr - 1]]) {
       for (j = 0; j < (stackptr - 1); j++) {
         if (vertextypes[vindex] == 1) {
-          triangle.Triangle(points[stack[j + 1]], points[stack[j]], points[vindex]);
+          sink->Add(indices[stack[j + 1]], indices[stack[j]], indices[vindex]);
         } else {
-          triangle.Triangle(points[stack[j]], points[stack[j + 1]], points[vindex]);
+          sink->Add(indices[stack[j]], indices[stack[j + 1]], indices[vindex]);
         }
-        triangles->push_back(triangle);
       }
       stack[0] = priority[i - 1];
       stack[1] = priority[i];
@@ -1784,17 +4156,15 @@ int TPPLPartition::TriangulateMonotone(TPPLPoly *inPoly, TPPLPolyList *triangles
       stackptr--;
       while (stackptr > 0) {
         if (vertextypes[vindex] == 1) {
-          if (IsConvex(points[vindex], points[stack[stackptr - 1]], points[stack[stackptr]])) {
-            triangle.Triangle(points[vindex], points[stack[stackptr - 1]], points[stack[stackptr]]);
-            triangles->push_back(triangle);
+          if (IsConvex(points[indices[vindex]], points[indices[stack[stackptr - 1]]], points[indices[stack[stackptr]]])) {
+            sink->Add(indices[vindex], indices[stack[stackptr - 1]], indices[stack[stackptr]]);
             stackptr--;
           } else {
             break;
           }
         } else {
-          if (IsConvex(points[vindex], points[stack[stackptr]], points[stack[stackptr - 1]])) {
-            triangle.Triangle(points[vindex], points[stack[stackptr]], points[stack[stackptr - 1]]);
-            triangles->push_back(triangle);
+          if (IsConvex(points[indices[vindex]], points[indices[stack[stackptr]]], points[indices[stack[stackptr - 1]]])) {
+            sink->Add(indices[vindex], indices[stack[stackptr]], indices[stack[stackptr - 1]]);
             stackptr--;
           } else {
             break;
@@ -1809,33 +4179,124 @@ int TPPLPartition::TriangulateMonotone(TPPLPoly *inPoly, TPPLPolyList *triangles
   vindex = priority[i];
   for (j = 0; j < (stackptr - 1); j++) {
     if (vertextypes[stack[j + 1]] == 1) {
-      triangle.Triangle(points[stack[j]], points[stack[j + 1]], points[vindex]);
+      sink->Add(indices[stack[j]], indices[stack[j + 1]], indices[vindex]);
     } else {
-      triangle.Triangle(points[stack[j + 1]], points[stack[j]], points[vindex]);
+      sink->Add(indices[stack[j + 1]], indices[stack[j]], indices[vindex]);
     }
-    triangles->push_back(triangle);
   }
 
-  delete[] priority;
-  delete[] vertextypes;
-  delete[] stack;
-
   return 1;
 }
 
 int TPPLPartition::Triangulate_MONO(TPPLPolyList *inpolys, TPPLPolyList *triangles) {
-  TPPLPolyList monotone;
-  TPPLPolyList::iterator iter;
+  TriangleSink sink(triangles);
+  return Triangulate_MONO(inpolys, &sink);
+}
+
+int TPPLPartition::Triangulate_MONO(TPPLPolyList *inpolys, uint32_t *indices) {
+  TriangleSink sink(indices);
+  return Triangulate_MONO(inpolys, &sink);
+}
 
-  if (!MonotonePartition(inpolys, &monotone)) {
+int TPPLPartition::Triangulate_MONO(TPPLPolyList *inpolys, TriangleSink *sink) {
+  TPPLWorkspaceScope scope(workspace);
+  TPPL_STATS_SCOPE();
+  TPPLMonotonePieces localpieces;
+  TPPLMonotonePieces *pieces = workspace ? &(workspace->pieces) : &localpieces;
+  long *offsets = NULL, *scratch = NULL, *first = NULL, *counts = NULL;
+  TPPLPolyList *lists = NULL;
+  int *rets = NULL;
+  long i, maxsize, numpieces;
+  int threads, ret;
+
+  if (!MonotonePartition(inpolys, pieces)) {
     return 0;
   }
-  for (iter = monotone.begin(); iter != monotone.end(); iter++) {
-    if (!TriangulateMonotone(&(*iter), triangles)) {
-      return 0;
+  TPPL_STATS_TIMER(timer, monotonetime);
+
+  numpieces = pieces->GetNumPieces();
+  offsets = pieces->GetOffsets();
+  threads = GetThreadCount(10 * pieces->GetNumIndices());
+  if (threads > numpieces) {
+    threads = (int)numpieces;
+  }
+  threads = std::max(threads, 1);
+
+  // Scratch memory for the largest piece is shared by all pieces of
+  // a thread.
+  maxsize = 0;
+  for (i = 0; i < numpieces; i++) {
+    maxsize = std::max(maxsize, pieces->GetNumVertices(i));
+  }
+  scratch = TPPLNewArray<long>(3 * maxsize * threads, workspace);
+
+  if (threads == 1) {
+    ret = 1;
+    for (i = 0; i < numpieces; i++) {
+      if (!TriangulateMonotone(pieces->GetPoints(), pieces->GetIndices() + offsets[i],
+                  pieces->GetNumVertices(i), scratch, sink)) {
+        ret = 0;
+        break;
+      }
     }
+    TPPLDeleteArray(scratch, 3 * maxsize, workspace);
+    return ret;
   }
-  return 1;
+
+  // Each thread triangulates a run of consecutive pieces with about the
+  // same number of vertices. A piece of n vertices gives n - 2 triangles,
+  // so each run has a known place in the index buffer. Triangle lists
+  // are kept per thread and joined in order afterwards.
+  first = TPPLNewArray<long>(threads + 1, workspace);
+  counts = TPPLNewArray<long>(threads, workspace);
+  rets = TPPLNewArray<int>(threads, workspace);
+  if (sink->triangles) {
+    lists = TPPLNewArray<TPPLPolyList>(threads, workspace);
+  }
+  for (i = 0; i < threads; i++) {
+    first[i] = std::lower_bound(offsets, offsets + numpieces,
+                       pieces->GetNumIndices() / threads * i) -
+            offsets;
+  }
+  first[threads] = numpieces;
+
+  TPPLRunThreads(threads, [&](int thread) {
+    long j;
+    TriangleSink threadsink(sink->indices ? sink->indices + 3 * (sink->numtriangles + offsets[first[thread]] - 2 * first[thread]) : NULL);
+    if (lists) {
+      threadsink.triangles = &lists[thread];
+    }
+    rets[thread] = 1;
+    for (j = first[thread]; j < first[thread + 1]; j++) {
+      if (!TriangulateMonotone(pieces->GetPoints(), pieces->GetIndices() + offsets[j],
+                  pieces->GetNumVertices(j), scratch + 3 * maxsize * thread, &threadsink)) {
+        rets[thread] = 0;
+        break;
+      }
+    }
+    counts[thread] = threadsink.numtriangles;
+  });
+
+  ret = 1;
+  for (i = 0; i < threads; i++) {
+    if (lists) {
+      sink->triangles->splice(sink->triangles->end(), lists[i]);
+    }
+    sink->numtriangles += counts[i];
+    if (!rets[i]) {
+      ret = 0;
+      break;
+    }
+  }
+
+  if (lists) {
+    TPPLDeleteArray(lists, threads, workspace);
+  }
+  TPPLDeleteArray(rets, threads, workspace);
+  TPPLDeleteArray(counts, threads, workspace);
+  TPPLDeleteArray(first, threads + 1, workspace);
+  TPPLDeleteArray(scratch, 3 * maxsize * threads, workspace);
+  return ret;
 }
 
 int TPPLPartition::Triangulate_MONO(TPPLPoly *poly, TPPLPolyList *triangles) {
@@ -1844,3 +4305,256 @@ int TPPLPartition::Triangulate_MONO(TPPLPoly *poly, TPPLPolyList *triangles) {
 
   return Triangulate_MONO(&polys, triangles);
 }
+
+int TPPLPartition::Triangulate_MONO(TPPLPoly *poly, uint32_t *indices) {
+  TPPLPolyList polys;
+  polys.push_back(*poly);
+
+  return Triangulate_MONO(&polys, indices);
+}
+
+int TPPLPartition::FlipToDelaunay(TPPLPoint *points, uint32_t *indices, long numtriangles) {
+  TPPLWorkspaceScope scope(workspace);
+  TPPL_STATS_SCOPE();
+  TPPL_STATS_TIMER(timer, fliptime);
+  uint64_t *keys = NULL;
+  long *neighbors = NULL, *sortededges = NULL, *stack = NULL;
+  bool *isQueued = NULL;
+  long numedges, stacksize, e, f, i, j, t, u;
+  long edges[4], outer[4];
+  uint32_t a, b, c, d;
+
+  numedges = 3 * numtriangles;
+  if (numedges == 0) {
+    return 1;
+  }
+
+  // Edge 3*t+i goes from vertex i to vertex (i+1)%3 of triangle t. Sort
+  // the edges by their endpoints, regardless of direction.
+  keys = TPPLNewArray<uint64_t>(numedges, workspace);
+  neighbors = TPPLNewArray<long>(numedges, workspace);
+  sortededges = TPPLNewArray<long>(numedges, workspace);
+  isQueued = TPPLNewArray<bool>(numedges, workspace);
+  stack = TPPLNewArray<long>(numedges, workspace);
+  for (e = 0; e < numedges; e++) {
+    a = indices[e];
+    b = indices[e - e % 3 + (e + 1) % 3];
+    keys[e] = ((uint64_t)std::min(a, b) << 32) | std::max(a, b);
+    neighbors[e] = -1;
+    isQueued[e] = false;
+    sortededges[e] = e;
+  }
+  std::sort(sortededges, sortededges + numedges, [keys](long edge1, long edge2) {
+    if (keys[edge1] != keys[edge2]) {
+      return keys[edge1] < keys[edge2];
+    }
+    return edge1 < edge2;
+  });
+
+  // A diagonal is an edge of exactly two triangles, in opposite
+  // directions. Polygon edges and anything less regular stay fixed.
+  for (i = 0; i < numedges; i = j) {
+    for (j = i + 1; (j < numedges) && (keys[sortededges[j]] == keys[sortededges[i]]); j++) {
+    }
+    if (j - i != 2) {
+      continue;
+    }
+    e = sortededges[i];
+    f = sortededges[i + 1];
+    if ((e / 3 == f / 3) || (indices[e] == indices[f])) {
+      continue;
+    }
+    neighbors[e] = f;
+    neighbors[f] = e;
+  }
+
+  stacksize = 0;
+  for (e = 0; e < numedges; e++) {
+    if (neighbors[e] > e) {
+      stack[stacksize++] = e;
+      isQueued[e] = true;
+    }
+  }
+
+  // Triangle a, b, c has the diagonal a, b, the triangle b, a, d on the
+  // other side. If d is inside the circumcircle of a, b, c, the diagonal
+  // is replaced by c, d, which turns the triangles into c, a, d and
+  // d, b, c. A flip is only done if the incircle test is certain, so every
+  // flip makes the triangulation strictly better and the loop ends. The
+  // four outer edges may need a flip afterwards.
+  while (stacksize > 0) {
+    e = stack[--stacksize];
+    isQueued[e] = false;
+    f = neighbors[e];
+    if (f < 0) {
+      continue;
+    }
+    t = e - e % 3;
+    u = f - f % 3;
+    a = indices[e];
+    b = indices[t + (e + 1) % 3];
+    c = indices[t + (e + 2) % 3];
+    d = indices[u + (f + 2) % 3];
+    if (TPPLInCircle(points[a], points[b], points[c], points[d]) <= 0) {
+      continue;
+    }
+    // The diagonal c, d has to be inside the quadrilateral a, d, b, c.
+    if ((TPPLOrient2D(points[a], points[d], points[c]) <= 0) ||
+            (TPPLOrient2D(points[d], points[b], points[c]) <= 0)) {
+      continue;
+    }
+    TPPL_STATS_ADD(numflips, 1);
+
+    outer[0] = neighbors[t + (e + 2) % 3];
+    outer[1] = neighbors[u + (f + 1) % 3];
+    outer[2] = neighbors[u + (f + 2) % 3];
+    outer[3] = neighbors[t + (e + 1) % 3];
+    indices[t] = c;
+    indices[t + 1] = a;
+    indices[t + 2] = d;
+    indices[u] = d;
+    indices[u + 1] = b;
+    indices[u + 2] = c;
+    neighbors[t + 2] = u + 2;
+    neighbors[u + 2] = t + 2;
+
+    edges[0] = t;
+    edges[1] = t + 1;
+    edges[2] = u;
+    edges[3] = u + 1;
+    for (i = 0; i < 4; i++) {
+      neighbors[edges[i]] = outer[i];
+      if (outer[i] >= 0) {
+        neighbors[outer[i]] = edges[i];
+        if (!isQueued[edges[i]]) {
+          stack[stacksize++] = edges[i];
+          isQueued[edges[i]] = true;
+        }
+      }
+    }
+  }
+
+  TPPLDeleteArray(stack, numedges, workspace);
+  TPPLDeleteArray(isQueued, numedges, workspace);
+  TPPLDeleteArray(sortededges, numedges, workspace);
+  TPPLDeleteArray(neighbors, numedges, workspace);
+  TPPLDeleteArray(keys, numedges, workspace);
+  return 1;
+}
+
+int TPPLPartition::FlipToDelaunay(TPPLPoly *poly, uint32_t *indices) {
+  long i, numtriangles;
+
+  numtriangles = GetNumTriangles(poly);
+  for (i = 0; i < 3 * numtriangles; i++) {
+    if (indices[i] >= (uint32_t)poly->GetNumPoints()) {
+      return 0;
+    }
+  }
+  return FlipToDelaunay(poly->GetPoints(), indices, numtriangles);
+}
+
+int TPPLPartition::FlipToDelaunay(TPPLPolyList *inpolys, uint32_t *indices) {
+  TPPLWorkspaceScope scope(workspace);
+  TPPLPolyList::iterator iter;
+  TPPLPoint *points = NULL;
+  long i, numpoints, numtriangles;
+  int ret;
+
+  numpoints = 0;
+  for (iter = inpolys->begin(); iter != inpolys->end(); iter++) {
+    numpoints += iter->GetNumPoints();
+  }
+  numtriangles = GetNumTriangles(inpolys);
+  for (i = 0; i < 3 * numtriangles; i++) {
+    if (indices[i] >= (uint32_t)numpoints) {
+      return 0;
+    }
+  }
+
+  points = TPPLNewArray<TPPLPoint>(numpoints, workspace);
+  numpoints = 0;
+  for (iter = inpolys->begin(); iter != inpolys->end(); iter++) {
+    for (i = 0; i < iter->GetNumPoints(); i++) {
+      points[numpoints++] = iter->GetPoint(i);
+    }
+  }
+  ret = FlipToDelaunay(points, indices, numtriangles);
+  TPPLDeleteArray(points, numpoints, workspace);
+  return ret;
+}
+
+int TPPLPartition::FlipToDelaunay(TPPLPolyList *triangles) {
+  TPPLWorkspaceScope scope(workspace);
+  TPPLPolyList::iterator iter;
+  TPPLPoint *points = NULL, *uniquepoints = NULL;
+  long *order = NULL;
+  uint32_t *indices = NULL;
+  long i, numvertices, numpoints;
+  int ret;
+
+  numvertices = 0;
+  for (iter = triangles->begin(); iter != triangles->end(); iter++) {
+    if (iter->GetNumPoints() != 3) {
+      return 0;
+    }
+    numvertices += 3;
+  }
+  if (numvertices == 0) {
+    return 1;
+  }
+
+  // Triangles are connected through vertices with equal coordinates, so
+  // every distinct point gets one index.
+  points = TPPLNewArray<TPPLPoint>(numvertices, workspace);
+  uniquepoints = TPPLNewArray<TPPLPoint>(numvertices, workspace);
+  order = TPPLNewArray<long>(numvertices, workspace);
+  indices = TPPLNewArray<uint32_t>(numvertices, workspace);
+  i = 0;
+  for (iter = triangles->begin(); iter != triangles->end(); iter++) {
+    points[i] = iter->GetPoint(0);
+    points[i + 1] = iter->GetPoint(1);
+    points[i + 2] = iter->GetPoint(2);
+    order[i] = i;
+    order[i + 1] = i + 1;
+    order[i + 2] = i + 2;
+    i += 3;
+  }
+  std::sort(order, order + numvertices, [points](long vertex1, long vertex2) {
+    if (points[vertex1].x != points[vertex2].x) {
+      return points[vertex1].x < points[vertex2].x;
+    }
+    if (points[vertex1].y != points[vertex2].y) {
+      return points[vertex1].y < points[vertex2].y;
+    }
+    return vertex1 < vertex2;
+  });
+  numpoints = 0;
+  for (i = 0; i < numvertices; i++) {
+    if ((i == 0) || (points[order[i]].x != points[order[i - 1]].x) ||
+            (points[order[i]].y != points[order[i - 1]].y)) {
+      uniquepoints[numpoints++] = points[order[i]];
+    }
+    indices[order[i]] = (uint32_t)(numpoints - 1);
+  }
+
+  ret = FlipToDelaunay(uniquepoints, indices, numvertices / 3);
+
+  i = 0;
+  for (iter = triangles->begin(); iter != triangles->end(); iter++) {
+    (*iter)[0] = uniquepoints[indices[i]];
+    (*iter)[1] = uniquepoints[indices[i + 1]];
+    (*iter)[2] = uniquepoints[indices[i + 2]];
+    i += 3;
+  }
+
+  TPPLDeleteArray(indices, numvertices, workspace);
+  TPPLDeleteArray(order, numvertices, workspace);
+  TPPLDeleteArray(uniquepoints, numvertices, workspace);
+  TPPLDeleteArray(points, numvertices, workspace);
+  return ret;
+}
+
+#ifdef TPPL_NAMESPACE
+}
+#endif
@@ -24,8 +24,10 @@
 #ifndef POLYPARTITION_H
 #define POLYPARTITION_H
 
+#include <stddef.h>
+#include <stdint.h>
 #include <list>
-#include <set>
+#include <vector>
 
 #ifndef tppl_float
 #define tppl_float double
@@ -33,6 +35,28 @@
 #ifndef tppl_sqrt
 #define tppl_sqrt sqrt
 #endif
+// Fused multiply-add, only used by the exact geometric predicates.
+#ifndef tppl_fma
+#define tppl_fma fma
+#endif
+
+// Polygons with up to this many points keep them inside
+// the TPPLPoly object instead of allocating memory.
+#ifndef TPPL_POLY_INLINE_POINTS
+#define TPPL_POLY_INLINE_POINTS 8
+#endif
+
+// Set to 0 to leave TPPLPoint::id out, for smaller points.
+#ifndef TPPL_POINT_ID
+#define TPPL_POINT_ID 1
+#endif
+
+// If defined, the library is declared in this namespace. Compiling
+// polypartition.cpp once per namespace, with different tppl_float or
+// TPPL_POINT_ID, puts several variants of the library in one program.
+#ifdef TPPL_NAMESPACE
+namespace TPPL_NAMESPACE {
+#endif
 
 enum TPPLOrientation {
   TPPL_ORIENTATION_CW = -1,
@@ -48,13 +72,26 @@ enum TPPLVertexType {
   TPPL_VERTEXTYPE_MERGE = 4,
 };
 
+// Order in which Triangulate_EC clips ears.
+enum TPPLEarPolicy {
+  // The most extruded ear (with the smallest angle) first.
+  TPPL_EARPOLICY_MOST_EXTRUDED = 0,
+  // The first ear found, fastest.
+  TPPL_EARPOLICY_FIRST = 1,
+  // The ear whose triangle has the smallest maximum angle first,
+  // gives the best shaped triangles.
+  TPPL_EARPOLICY_MIN_MAX_ANGLE = 2,
+};
+
 // 2D point structure.
 struct TPPLPoint {
   tppl_float x;
   tppl_float y;
+#if TPPL_POINT_ID
   // User-specified vertex identifier. Note that this isn't used internally
   // by the library, but will be faithfully copied around.
   int id;
+#endif
 
   TPPLPoint operator+(const TPPLPoint &p) const {
     TPPLPoint r;
@@ -94,11 +131,15 @@ struct TPPLPoint {
 };
 
 // Polygon implemented as an array of points with a "hole" flag.
+// Points of small polygons are stored inline, see TPPL_POLY_INLINE_POINTS.
 class TPPLPoly {
   protected:
   TPPLPoint *points;
   long numpoints;
   bool hole;
+  // The points are owned by the caller, see Attach.
+  bool attached;
+  TPPLPoint inlinepoints[TPPL_POLY_INLINE_POINTS];
 
   public:
   // Constructors and destructors.
@@ -108,6 +149,10 @@ class TPPLPoly {
   TPPLPoly(const TPPLPoly &src);
   TPPLPoly &operator=(const TPPLPoly &src);
 
+  // Move constructor and assignment. The source polygon is left empty.
+  TPPLPoly(TPPLPoly &&src);
+  TPPLPoly &operator=(TPPLPoly &&src);
+
   // Getters and setters.
   long GetNumPoints() const {
     return numpoints;
@@ -147,8 +192,13 @@ class TPPLPoly {
   // Inits the polygon with numpoints vertices.
   void Init(long numpoints);
 
+  // Makes the polygon use numpoints points owned by the caller, without
+  // copying them. They have to stay valid until the polygon is cleared
+  // or destroyed. Copies of the polygon get their own points.
+  void Attach(TPPLPoint *points, long numpoints);
+
   // Creates a triangle with points p1, p2, and p3.
-  void Triangle(TPPLPoint &p1, TPPLPoint &p2, TPPLPoint &p3);
+  void Triangle(const TPPLPoint &p1, const TPPLPoint &p2, const TPPLPoint &p3);
 
   // Inverts the orfer of vertices.
   void Invert();
@@ -172,20 +222,317 @@ class TPPLPoly {
   inline bool Valid() const { return this->numpoints >= 3; }
 };
 
+// Visibility graph of a polygon, stored as a bit matrix. Two vertices
+// are visible from each other if they are connected by a polygon edge,
+// or by a diagonal lying inside the polygon.
+class TPPLVisibilityGraph {
+  protected:
+  long numvertices;
+  // Number of 64-bit words per row.
+  long rowsize;
+  uint64_t *bits;
+
+  public:
+  TPPLVisibilityGraph();
+  ~TPPLVisibilityGraph();
+
+  TPPLVisibilityGraph(const TPPLVisibilityGraph &src);
+  TPPLVisibilityGraph &operator=(const TPPLVisibilityGraph &src);
+
+  long GetNumVertices() const {
+    return numvertices;
+  }
+
+  bool IsVisible(long i, long j) const {
+    return (bits[i * rowsize + j / 64] >> (j % 64)) & 1;
+  }
+
+  void SetVisible(long i, long j, bool visible) {
+    if (visible) {
+      bits[i * rowsize + j / 64] |= (uint64_t)1 << (j % 64);
+    } else {
+      bits[i * rowsize + j / 64] &= ~((uint64_t)1 << (j % 64));
+    }
+  }
+
+  // Returns the bits of row i, vertex j being bit j % 64 of word j / 64.
+  const uint64_t *GetRow(long i) const {
+    return bits + i * rowsize;
+  }
+
+  // Clears the graph.
+  void Clear();
+
+  // Inits the graph with numvertices vertices, none visible.
+  void Init(long numvertices);
+};
+
+// Monotone pieces of a list of polygons, as produced by
+// TPPLPartition::MonotonePartition. The vertices of all pieces are
+// stored in a single array of point indices: piece i consists of
+// indices[offsets[i]] to indices[offsets[i + 1] - 1], in
+// counter-clockwise order. Points are those of the input polygons,
+// numbered across all polygons in list order. Also used by
+// Triangulate_EC for the polygons left by RemoveHoles.
+class TPPLMonotonePieces {
+  protected:
+  long numpoints;
+  long numpieces;
+  long numindices;
+  // Allocated sizes, kept when the pieces are re-initialized.
+  long maxpoints, maxpieces, maxindices;
+  TPPLPoint *points;
+  // numpieces + 1 entries, the last one is numindices.
+  long *offsets;
+  long *indices;
+
+  public:
+  TPPLMonotonePieces();
+  ~TPPLMonotonePieces();
+
+  TPPLMonotonePieces(const TPPLMonotonePieces &src);
+  TPPLMonotonePieces &operator=(const TPPLMonotonePieces &src);
+
+  long GetNumPoints() const {
+    return numpoints;
+  }
+
+  long GetNumPieces() const {
+    return numpieces;
+  }
+
+  long GetNumIndices() const {
+    return numindices;
+  }
+
+  TPPLPoint *GetPoints() {
+    return points;
+  }
+
+  long *GetOffsets() {
+    return offsets;
+  }
+
+  long *GetIndices() {
+    return indices;
+  }
+
+  // Returns the number of vertices of piece i.
+  long GetNumVertices(long i) const {
+    return offsets[i + 1] - offsets[i];
+  }
+
+  // Clears the pieces and frees their memory.
+  void Clear();
+
+  // Inits storage for numpieces pieces with numindices vertices in total.
+  // Memory is only reallocated if it is too small.
+  void Init(long numpoints, long numpieces, long numindices);
+};
+
+// Scratch memory for the partitioning methods, set with
+// TPPLPartition::SetWorkspace. Temporary arrays are then taken from the
+// workspace instead of being allocated on every call. The workspace only
+// grows, so once it is large enough for the polygons at hand, repeated
+// calls allocate no scratch memory. A workspace can only be used by
+// one thread at a time.
+class TPPLWorkspace {
+  protected:
+  char *memory;
+  size_t size;
+  size_t used;
+  // Blocks allocated once memory was full, newest first, each starting
+  // with the address of the next one. Later allocations also go into
+  // blocks, so that they are released in reverse order. Once all memory
+  // is released, memory is grown by the largest blocksize reached.
+  char *blocks;
+  size_t blocksize;
+  size_t maxblocksize;
+  // Monotone pieces of Triangulate_MONO.
+  TPPLMonotonePieces pieces;
+  // Polygons without holes of Triangulate_EC.
+  TPPLMonotonePieces outerpolys;
+#ifdef TPPL_ALLOCATOR
+  typedef std::vector<long, TPPL_ALLOCATOR(long)> IndexArray;
+#else
+  typedef std::vector<long> IndexArray;
+#endif
+  // Cell list entries of the grid in RemoveHoles. Their number is only
+  // known as edges are added, so the vector is kept to reuse its capacity.
+  IndexArray gridentries;
+
+  friend class TPPLPartition;
+
+  void FreeBlocks();
+
+  public:
+  TPPLWorkspace();
+  ~TPPLWorkspace();
+
+  TPPLWorkspace(const TPPLWorkspace &src) = delete;
+  TPPLWorkspace &operator=(const TPPLWorkspace &src) = delete;
+
+  // Returns the number of bytes of scratch memory held by the workspace.
+  size_t GetSize() const {
+    return size + blocksize;
+  }
+
+  // Returns the number of bytes currently in use.
+  size_t GetUsed() const {
+    return used + blocksize;
+  }
+
+  // Returns bytes of memory, aligned for any type.
+  void *Allocate(size_t bytes);
+
+  // Releases all memory allocated since GetUsed returned used.
+  void Release(size_t used);
+
+  // Frees all memory held by the workspace.
+  void Clear();
+};
+
+// If TPPL_ALLOCATOR is defined, TPPL_ALLOCATOR(T) has to name an allocator
+// type for T. All memory allocated by the library, including polygon
+// points, result lists and scratch memory of the partitioning methods,
+// then goes through default-constructed instances of that allocator.
 #ifdef TPPL_ALLOCATOR
 typedef std::list<TPPLPoly, TPPL_ALLOCATOR(TPPLPoly)> TPPLPolyList;
 #else
 typedef std::list<TPPLPoly> TPPLPolyList;
 #endif
 
+// Header of the binary polygon format read and written by TPPLPolyFile.
+// It is followed by
+//    uint64_t offsets[numpolys + 1]: the index of the first point of
+//       every polygon, and numpoints.
+//    uint8_t holes[numpolys]: 1 for holes, 0 otherwise, padded with zeros
+//       to a multiple of 8 bytes.
+//    double points[2 * numpoints]: x and y of every point.
+// Values are in the byte order of the machine that wrote the file, which
+// byteorder tells apart. Point ids are not stored.
+struct TPPLPolyFileHeader {
+  char magic[4];
+  uint32_t version;
+  uint32_t byteorder;
+  uint32_t reserved;
+  uint64_t numpolys;
+  uint64_t numpoints;
+};
+
+// Polygons in the binary format of TPPLPolyFileHeader, mapped into
+// memory. Loading them needs no parsing, and if TPPLPoint consists of
+// two doubles (TPPL_POINT_ID 0 and tppl_float double), the polygons
+// use the mapped points directly instead of copying them.
+class TPPLPolyFile {
+  protected:
+  char *data;
+  size_t size;
+  // data was mapped, rather than read into allocated memory.
+  bool mapped;
+
+  public:
+  TPPLPolyFile();
+  ~TPPLPolyFile();
+
+  TPPLPolyFile(const TPPLPolyFile &src) = delete;
+  TPPLPolyFile &operator=(const TPPLPolyFile &src) = delete;
+
+  // Maps a file into memory, copy-on-write, so that changes to the
+  // polygons don't reach the file. Where memory mapping isn't available,
+  // the file is read instead.
+  // Returns 1 on success, 0 on failure.
+  int Open(const char *filename);
+
+  // Unmaps the file. Polygons still using its points become invalid.
+  void Close();
+
+  // Appends the polygons of the open file to polys. They stay valid
+  // until the file is closed.
+  // Returns 1 on success, 0 if the file is not in the binary format.
+  int GetPolys(TPPLPolyList *polys);
+
+  // Appends the polygons in data, in the binary format, to polys.
+  // Points are attached to data if their layout allows it, so data
+  // has to be aligned to 8 bytes and outlive the polygons.
+  // Returns 1 on success, 0 if data is not in the binary format.
+  static int Read(void *data, size_t size, TPPLPolyList *polys);
+
+  // Writes polys to a file in the binary format, for example the
+  // result of a partition.
+  // Returns 1 on success, 0 on failure.
+  static int Write(const char *filename, TPPLPolyList *polys);
+};
+
+// Statistics collected by the partitioning methods, set with
+// TPPLPartition::SetStats. They are only gathered if polypartition.cpp is
+// compiled with TPPL_STATS defined, otherwise the counters stay 0 and the
+// library has no overhead. Every call adds to the counters, so they
+// cover all calls since the last Clear. Work done by worker threads is
+// added up, so times can exceed the wall time of a call.
+struct TPPLStats {
+  // Calls of the geometric predicates: IsConvex and IsReflex,
+  // Intersects (segment pairs) and IsInside (point in triangle).
+  long numconvextests;
+  long numintersecttests;
+  long numinsidetests;
+  // UpdateVertex calls of Triangulate_EC, and how many of them tested a
+  // convex vertex for being an ear.
+  long numvertexupdates;
+  long numeartests;
+  // Insert, Remove and FindLeft operations on the sweep line tree
+  // of MonotonePartition.
+  long numsweepoperations;
+  // Dynamic programming states computed by Triangulate_OPT and
+  // ConvexPartition_OPT.
+  long numdpstates;
+  // Holes merged into polygons by RemoveHoles.
+  long numholesbridged;
+  // Edges flipped by FlipToDelaunay.
+  long numflips;
+  // Bytes allocated from the heap (or TPPL_ALLOCATOR) for arrays.
+  // Workspace memory only counts when the workspace grows.
+  size_t numbytesallocated;
+  // Wall time in seconds of RemoveHoles, GetVisibilityGraph, the dynamic
+  // programming of the OPT methods, ear clipping, merging the triangles
+  // of ConvexPartition_HM, the sweep of MonotonePartition and
+  // triangulating the monotone pieces in Triangulate_MONO and of
+  // FlipToDelaunay.
+  double removeholestime;
+  double visibilitytime;
+  double dptime;
+  double earclippingtime;
+  double mergetime;
+  double sweeptime;
+  double monotonetime;
+  double fliptime;
+
+  TPPLStats() {
+    Clear();
+  }
+
+  void Clear();
+
+  // Adds the counters of stats to these.
+  void Add(const TPPLStats &stats);
+};
+
 class TPPLPartition {
   protected:
+  TPPLEarPolicy earpolicy;
+  int numthreads;
+  size_t memorylimit;
+  TPPLWorkspace *workspace;
+  TPPLStats *stats;
+
   struct PartitionVertex {
     bool isActive;
     bool isConvex;
     bool isEar;
 
     TPPLPoint p;
+    long index;
+    // Ear priority in Triangulate_EC, higher first.
     tppl_float angle;
     PartitionVertex *previous;
     PartitionVertex *next;
@@ -193,8 +540,99 @@ class TPPLPartition {
     PartitionVertex();
   };
 
+  // Uniform grid over the active non-convex vertices of a polygon, used in
+  // Triangulate_EC to find the vertices that can lie inside an ear.
+  // Only non-convex vertices are checked: if any vertex lies strictly
+  // inside a candidate ear, so does a non-convex one. A convex vertex on
+  // the boundary of the ear is not seen, so on degenerate input the ears
+  // can differ from checking every vertex.
+  struct VertexGrid {
+    PartitionVertex *vertices;
+    long numvertices;
+    tppl_float minx, miny;
+    tppl_float invcellwidth, invcellheight;
+    long numcellsx, numcellsy;
+    // Vertices in cell c are cellvertices[cellstart[c]] ...
+    // cellvertices[cellstart[c] + cellcount[c] - 1]. Each cell has
+    // room for all the polygon vertices that fall into it.
+    long *cellstart;
+    long *cellcount;
+    long *cellvertices;
+    // Coordinates of the vertices in cellvertices, in the same order,
+    // so that whole cells can be tested at once.
+    tppl_float *cellx;
+    tppl_float *celly;
+    // Position of each vertex in cellvertices, -1 if not in the grid.
+    long *positions;
+    TPPLWorkspace *workspace;
+
+    // Creates the grid and adds all vertices that are not convex.
+    VertexGrid(PartitionVertex *vertices, long numvertices, TPPLWorkspace *workspace);
+    ~VertexGrid();
+
+    // Returns the cell coordinates of a point.
+    long GetCellX(tppl_float x);
+    long GetCellY(tppl_float y);
+
+    // Adds a vertex to the grid, or removes it from the grid.
+    // Does nothing if the vertex is already in or out of the grid.
+    void Insert(long index);
+    void Remove(long index);
+  };
+
+  // Binary heap of the ears of a polygon, used in Triangulate_EC to select
+  // the next ear to clip. Ears with higher angle come first, ties are
+  // broken in favor of the lower vertex index.
+  struct EarHeap {
+    PartitionVertex *vertices;
+    long numvertices;
+    long size;
+    long *heap;
+    // Position of each vertex in heap, -1 if not in the heap.
+    long *positions;
+
+    TPPLWorkspace *workspace;
+    EarHeap(PartitionVertex *vertices, long numvertices, TPPLWorkspace *workspace);
+    ~EarHeap();
+
+    // Adds, moves or removes a vertex after its ear status changed.
+    void Update(long index);
+
+    bool Before(long index1, long index2);
+    void Move(long index, long position);
+    void SiftUp(long position);
+    void SiftDown(long position);
+  };
+
+  // Half-edge of a polygon in ConvexPartition_HM. Starts at the point
+  // with the same index as the half-edge and ends where the next starts.
+  struct PartitionEdge {
+    long previous, next;
+    bool isQueued;
+  };
+
+  class PartitionEdgeSorter {
+    TPPLPoint *points;
+
+public:
+    PartitionEdgeSorter(TPPLPoint *p) :
+            points(p) {}
+    bool operator()(long index1, long index2);
+  };
+
+  // Sorts polygons by falling number of points, then by index.
+  class PolySizeSorter {
+    TPPLPoly **polys;
+
+public:
+    PolySizeSorter(TPPLPoly **p) :
+            polys(p) {}
+    bool operator()(long index1, long index2);
+  };
+
   struct MonotoneVertex {
     TPPLPoint p;
+    long index;
     long previous;
     long next;
   };
@@ -219,30 +657,173 @@ public:
   typedef std::list<Diagonal> DiagonalList;
 #endif
 
+  // Vertex indices, the same type as TPPLWorkspace::gridentries.
+  typedef TPPLWorkspace::IndexArray IndexArray;
+
+  // Vertex of the outer polygons in RemoveHoles. Holes are spliced
+  // into the rings of these vertices as they are removed.
+  struct RingVertex {
+    TPPLPoint p;
+    long index;
+    long ring;
+    // Distance to the current hole vertex.
+    tppl_float distance;
+
+    RingVertex *previous, *next;
+  };
+
+  class RingVertexSorter {
+    RingVertex *vertices;
+
+public:
+    RingVertexSorter(RingVertex *v) :
+            vertices(v) {}
+    bool operator()(long index1, long index2);
+  };
+
+  // Uniform grid over polygon vertices and edges. Used in RemoveHoles to
+  // find the vertices a hole can be connected to, and to check diagonals
+  // for visibility. Cells keep linked lists of vertices and edges, as the
+  // outer polygons in RemoveHoles grow with every hole that is removed.
+  struct EdgeGrid {
+    tppl_float minx, miny;
+    tppl_float cellwidth, cellheight;
+    tppl_float invcellwidth, invcellheight;
+    long numcellsx, numcellsy;
+    // First entry of the vertex and edge list of each cell, -1 if empty.
+    long *vertexlists;
+    long *edgelists;
+    // List entries, pairs of vertex or edge number and the next entry.
+    // Those of the workspace are used if there is one.
+    IndexArray localentries;
+    IndexArray &entries;
+    // Edge endpoints, edge e goes from edgepoints[2*e] to edgepoints[2*e+1].
+    TPPLPoint *edgepoints;
+    long numedges, maxedges;
+    // Used to check every edge only once per query.
+    long *edgestamps;
+    long stamp;
+    TPPLWorkspace *workspace;
+
+    // Creates an empty grid over the bounding box of polys, or of poly.
+    EdgeGrid(TPPLPolyList *polys, long maxedges, TPPLWorkspace *workspace);
+    EdgeGrid(TPPLPoly *poly, long maxedges, TPPLWorkspace *workspace);
+    ~EdgeGrid();
+
+    void Init(tppl_float minx, tppl_float miny, tppl_float maxx, tppl_float maxy, long numvertices, long maxedges);
+
+    // Returns the cell coordinates of a point.
+    long GetCellX(tppl_float x);
+    long GetCellY(tppl_float y);
+
+    void AddVertex(long index, const TPPLPoint &p);
+    void AddEdge(const TPPLPoint &p1, const TPPLPoint &p2);
+  };
+
+  // Destination of the triangles produced by the triangulation methods.
+  // Triangles are given as indices into points. They are either appended
+  // to triangles or, when triangles is NULL, written to the index buffer,
+  // with each index translated through remap (if not NULL).
+  struct TriangleSink {
+    const TPPLPoint *points;
+    const long *remap;
+    TPPLPolyList *triangles;
+    uint32_t *indices;
+    long numtriangles;
+
+    TriangleSink(TPPLPolyList *triangles);
+    TriangleSink(uint32_t *indices);
+    void Add(long index1, long index2, long index3);
+  };
+
   // Dynamic programming state for minimum-weight triangulation.
+  // Kept twice, in rows of equal first and of equal second vertex,
+  // so both halves of a split are read from contiguous memory.
   struct DPState {
-    bool visible;
     tppl_float weight;
-    long bestvertex;
+    // Length of the diagonal, 0 for polygon edges and -1 if the
+    // diagonal is not visible.
+    tppl_float length;
   };
 
-  // Dynamic programming state for convex partitioning.
+  // Dynamic programming state for convex partitioning. Its pairs are
+  // kept in a DiagonalPool, as a list from firstpair to lastpair
+  // (-1 if empty).
   struct DPState2 {
     bool visible;
     long weight;
-    DiagonalList pairs;
+    long firstpair, lastpair;
   };
 
-  // Edge that intersects the scanline.
+  // Entry of a DPState2 pair list.
+  struct DiagonalNode {
+    long index1;
+    long index2;
+    long previous, next;
+  };
+
+#ifdef TPPL_ALLOCATOR
+  typedef std::vector<DiagonalNode, TPPL_ALLOCATOR(DiagonalNode)> DiagonalNodeArray;
+#else
+  typedef std::vector<DiagonalNode> DiagonalNodeArray;
+#endif
+
+  // Storage for the pair lists of all states in ConvexPartition_OPT.
+  // Lists are linked through node indices in a single array, and
+  // nodes of cleared lists are reused, so clearing takes O(1) time.
+  struct DiagonalPool {
+    DiagonalNodeArray nodes;
+    // First unused node, -1 if none.
+    long freenodes;
+    // Maximum number of nodes. exhausted is set when a list
+    // could not grow because of it.
+    long maxnodes;
+    bool exhausted;
+
+    DiagonalPool(long maxnodes) :
+            freenodes(-1), maxnodes(maxnodes), exhausted(false) {}
+
+    void PushFront(DPState2 *state, long index1, long index2);
+    void PopFront(DPState2 *state);
+    void PopBack(DPState2 *state);
+    void Clear(DPState2 *state);
+  };
+
+  // Edge that intersects the scanline, a node of a ScanLineTree.
   struct ScanLineEdge {
-    mutable long index;
-    TPPLPoint p1;
-    TPPLPoint p2;
+    long index;
+    TPPLPoint p1, p2;
+    long left, right, parent;
+    uint32_t priority;
 
     // Determines if the edge is to the left of another edge.
-    bool operator<(const ScanLineEdge &other) const;
+    bool IsLeftOf(const ScanLineEdge &other) const;
+    // Determines if the edge is to the left of a point on the scanline.
+    bool IsLeftOf(const TPPLPoint &p) const;
+    // Determines if p is to the left of the edge's line.
+    bool IsConvex(const TPPLPoint &p) const;
+  };
+
+  // Edges that intersect the scanline, ordered from left to right.
+  // A treap, with the nodes in a single array, so that inserting
+  // and removing edges does not allocate.
+  struct ScanLineTree {
+    ScanLineEdge *edges;
+    long maxedges;
+    long root;
+
+    TPPLWorkspace *workspace;
+
+    ScanLineTree(long maxedges, TPPLWorkspace *workspace);
+    ~ScanLineTree();
 
-    bool IsConvex(const TPPLPoint &p1, const TPPLPoint &p2, const TPPLPoint &p3) const;
+    // Inserts the edge from p1 to p2 of vertex e as node e.
+    void Insert(long e, const TPPLPoint &p1, const TPPLPoint &p2);
+    void Remove(long e);
+    // Returns the edge directly to the left of p, -1 if there is none.
+    long FindLeft(const TPPLPoint &p);
+    // Moves edge e above its parent.
+    void Rotate(long e);
   };
 
   // Standard helper functions.
@@ -254,33 +835,140 @@ public:
   bool InCone(PartitionVertex *v, TPPLPoint &p);
 
   int Intersects(TPPLPoint &p11, TPPLPoint &p12, TPPLPoint &p21, TPPLPoint &p22);
+  int Intersects(EdgeGrid *grid, long cell, TPPLPoint &p1, TPPLPoint &p2);
+  int Intersects(EdgeGrid *grid, TPPLPoint &p1, TPPLPoint &p2);
+  bool IsBefore(RingVertex *v1, RingVertex *v2, RingVertex **ringheads, long *ringorder);
 
   TPPLPoint Normalize(const TPPLPoint &p);
   tppl_float Distance(const TPPLPoint &p1, const TPPLPoint &p2);
+  tppl_float SignedSquaredCosine(const TPPLPoint &p1, const TPPLPoint &p2);
 
   // Helper functions for Triangulate_EC.
   void UpdateVertexReflexity(PartitionVertex *v);
-  void UpdateVertex(PartitionVertex *v, PartitionVertex *vertices, long numvertices);
+  void UpdateVertex(PartitionVertex *v, VertexGrid *grid);
 
   // Helper functions for ConvexPartition_OPT.
-  void UpdateState(long a, long b, long w, long i, long j, DPState2 **dpstates);
-  void TypeA(long i, long j, long k, PartitionVertex *vertices, DPState2 **dpstates);
-  void TypeB(long i, long j, long k, PartitionVertex *vertices, DPState2 **dpstates);
+  void UpdateState(long a, long b, long w, long i, long j, DPState2 **dpstates, DiagonalPool *pool);
+  void TypeA(long i, long j, long k, PartitionVertex *vertices, DPState2 **dpstates, DiagonalPool *pool);
+  void TypeB(long i, long j, long k, PartitionVertex *vertices, DPState2 **dpstates, DiagonalPool *pool);
 
   // Helper functions for MonotonePartition.
   bool Below(TPPLPoint &p1, TPPLPoint &p2);
   void AddDiagonal(MonotoneVertex *vertices, long *numvertices, long index1, long index2,
-          TPPLVertexType *vertextypes, std::set<ScanLineEdge>::iterator *edgeTreeIterators,
-          std::set<ScanLineEdge> *edgeTree, long *helpers);
+          TPPLVertexType *vertextypes, long *edgeTreeNodes,
+          ScanLineTree *edgeTree, long *helpers);
 
   // Triangulates a monotone polygon, used in Triangulate_MONO.
-  int TriangulateMonotone(TPPLPoly *inPoly, TPPLPolyList *triangles);
+  // Its vertices are points[indices[0]] to points[indices[numpoints - 1]].
+  // scratch has to hold 3 * numpoints entries.
+  int TriangulateMonotone(TPPLPoint *points, long *indices, long numpoints,
+          long *scratch, TriangleSink *sink);
+
+  // Removes holes like the public version, writing the polygons as
+  // pieces. Their points are those of inpolys, in list order.
+  int RemoveHoles(TPPLPolyList *inpolys, TPPLMonotonePieces *outpolys);
+
+  // Triangulation methods writing their result to a TriangleSink.
+  int Triangulate_EC(TPPLPoly *poly, TriangleSink *sink);
+  int Triangulate_EC(TPPLPolyList *inpolys, TriangleSink *sink);
+  int Triangulate_OPT(TPPLPoly *poly, TriangleSink *sink);
+  int Triangulate_MONO(TPPLPolyList *inpolys, TriangleSink *sink);
+
+  // Flips the edges of numtriangles triangles, three indices into points
+  // each, see the public versions.
+  int FlipToDelaunay(TPPLPoint *points, uint32_t *indices, long numtriangles);
+
+  long GetBestVertex(long i, long j, DPState **rows, DPState **columns, tppl_float *minweight);
+  int GetThreadCount(long work);
+  size_t GetConvexPartition_OPTMemory(long numvertices);
 
   public:
+  TPPLPartition();
+
+  // Sets the order in which Triangulate_EC clips ears, and thus the shape
+  // of the resulting triangles. Also affects ConvexPartition_HM.
+  // The default is TPPL_EARPOLICY_MOST_EXTRUDED.
+  void SetEarPolicy(TPPLEarPolicy policy) {
+    earpolicy = policy;
+  }
+
+  TPPLEarPolicy GetEarPolicy() const {
+    return earpolicy;
+  }
+
+  // Sets the maximum number of threads used by Triangulate_OPT,
+  // GetVisibilityGraph, Triangulate_MONO (for the monotone pieces) and
+  // the polygon list versions of Triangulate_EC and ConvexPartition_HM,
+  // which partition the polygons in parallel, largest first.
+  // 0 uses one thread per hardware thread.
+  // The default is 1. With more than one thread, TPPL_ALLOCATOR
+  // (if defined) has to be thread-safe.
+  void SetNumThreads(int threads) {
+    numthreads = threads;
+  }
+
+  int GetNumThreads() const {
+    return numthreads;
+  }
+
+  // Sets the maximum number of bytes ConvexPartition_OPT may use for its
+  // tables. Polygons that would need more are partitioned with
+  // ConvexPartition_HM instead. 0 means no limit, which is the default.
+  void SetMemoryLimit(size_t bytes) {
+    memorylimit = bytes;
+  }
+
+  size_t GetMemoryLimit() const {
+    return memorylimit;
+  }
+
+  // Sets the workspace that scratch memory is taken from, NULL to
+  // allocate it on every call, which is the default. The workspace is
+  // owned by the caller and can't be shared by partitions used in
+  // different threads. Worker threads started for SetNumThreads
+  // allocate their own memory.
+  void SetWorkspace(TPPLWorkspace *workspace) {
+    this->workspace = workspace;
+  }
+
+  TPPLWorkspace *GetWorkspace() const {
+    return workspace;
+  }
+
+  // Sets the statistics that the methods add to, NULL for none,
+  // which is the default. Requires TPPL_STATS, see TPPLStats.
+  void SetStats(TPPLStats *stats) {
+    this->stats = stats;
+  }
+
+  TPPLStats *GetStats() const {
+    return stats;
+  }
+
+  // Computes which vertices of a polygon can be connected by a diagonal.
+  // Used by Triangulate_OPT and ConvexPartition_OPT. Polygon edges are
+  // looked up in a uniform grid, so typically only the edges near a
+  // diagonal are checked.
+  // Time complexity: O(n^2*sqrt(n)) typically, O(n^3) worst case,
+  // n is the number of vertices.
+  // Space complexity: O(n^2)
+  // params:
+  //    poly:
+  //       An input polygon.
+  //       Vertices have to be in counter-clockwise order.
+  //    graph:
+  //       The visibility graph (result).
+  // Returns 1 on success, 0 on failure.
+  int GetVisibilityGraph(TPPLPoly *poly, TPPLVisibilityGraph *graph);
+
   // Simple heuristic procedure for removing holes from a list of polygons.
   // It works by creating a diagonal from the right-most hole vertex
-  // to some other visible vertex.
-  // Time complexity: O(h*(n^2)), h is the # of holes, n is the # of vertices.
+  // to the closest visible vertex. Holes are removed in the order of
+  // their right-most vertex, and the closest visible vertex is searched
+  // for in a uniform grid, so typically only the vertices and edges
+  // near the hole need to be checked.
+  // Time complexity: O(h*(n^2)) worst case, h is the # of holes,
+  // n is the # of vertices.
   // Space complexity: O(n)
   // params:
   //    inpolys:
@@ -292,8 +980,27 @@ public:
   // Returns 1 on success, 0 on failure.
   int RemoveHoles(TPPLPolyList *inpolys, TPPLPolyList *outpolys);
 
+  // Returns the number of triangles in a triangulation of a polygon,
+  // that is n - 2, n is the number of vertices.
+  static long GetNumTriangles(TPPLPoly *poly);
+
+  // Returns the number of triangles in a triangulation of a list of
+  // polygons that may contain holes, that is n - 2*p + 2*h, where n is
+  // the total number of vertices, p is the # of non-hole polygons and
+  // h is the # of holes. Index buffers passed to the triangulation
+  // methods need to hold three times as many entries.
+  static long GetNumTriangles(TPPLPolyList *inpolys);
+
   // Triangulates a polygon by ear clipping.
-  // Time complexity: O(n^2), n is the number of vertices.
+  // Ear tests only check the non-convex vertices in the bounding box of
+  // the ear, found through a uniform grid, and ears are selected from
+  // a heap in the order given by SetEarPolicy.
+  // Vertices that were already clipped, and convex vertices, are not
+  // checked. On degenerate input, where such a vertex touches a candidate
+  // ear, the ear is accepted, so the result can differ from checking
+  // every vertex.
+  // Time complexity: O(n*r + n*log(n)), n is the number of vertices,
+  // r is the number of reflex vertices.
   // Space complexity: O(n)
   // params:
   //    poly:
@@ -304,6 +1011,18 @@ public:
   // Returns 1 on success, 0 on failure.
   int Triangulate_EC(TPPLPoly *poly, TPPLPolyList *triangles);
 
+  // Triangulates a polygon by ear clipping, writing the triangles
+  // to an index buffer instead of a list of polygons.
+  // params:
+  //    poly:
+  //       An input polygon to be triangulated.
+  //       Vertices have to be in counter-clockwise order.
+  //    indices:
+  //       Three vertex indices of poly per triangle (result).
+  //       Has to hold 3 * GetNumTriangles(poly) entries.
+  // Returns 1 on success, 0 on failure.
+  int Triangulate_EC(TPPLPoly *poly, uint32_t *indices);
+
   // Triangulates a list of polygons that may contain holes by ear clipping
   // algorithm. It first calls RemoveHoles to get rid of the holes, and then
   // calls Triangulate_EC for each resulting polygon.
@@ -319,7 +1038,23 @@ public:
   // Returns 1 on success, 0 on failure.
   int Triangulate_EC(TPPLPolyList *inpolys, TPPLPolyList *triangles);
 
+  // Triangulates a list of polygons that may contain holes by ear clipping,
+  // writing the triangles to an index buffer.
+  // params:
+  //    inpolys:
+  //       A list of polygons to be triangulated (can contain holes).
+  //       Vertices of all non-hole polys have to be in counter-clockwise order.
+  //       Vertices of all hole polys have to be in clockwise order.
+  //    indices:
+  //       Three vertex indices per triangle (result). Vertices are numbered
+  //       across all polygons in inpolys, in list order.
+  //       Has to hold 3 * GetNumTriangles(inpolys) entries.
+  // Returns 1 on success, 0 on failure.
+  int Triangulate_EC(TPPLPolyList *inpolys, uint32_t *indices);
+
   // Creates an optimal polygon triangulation in terms of minimal edge length.
+  // Diagonals of equal span are independent of each other, so each span
+  // is computed in parallel on the threads set by SetNumThreads.
   // Time complexity: O(n^3), n is the number of vertices
   // Space complexity: O(n^2)
   // params:
@@ -331,6 +1066,18 @@ public:
   // Returns 1 on success, 0 on failure.
   int Triangulate_OPT(TPPLPoly *poly, TPPLPolyList *triangles);
 
+  // Creates an optimal polygon triangulation in terms of minimal edge length,
+  // writing the triangles to an index buffer.
+  // params:
+  //    poly:
+  //       An input polygon to be triangulated.
+  //       Vertices have to be in counter-clockwise order.
+  //    indices:
+  //       Three vertex indices of poly per triangle (result).
+  //       Has to hold 3 * GetNumTriangles(poly) entries.
+  // Returns 1 on success, 0 on failure.
+  int Triangulate_OPT(TPPLPoly *poly, uint32_t *indices);
+
   // Triangulates a polygon by first partitioning it into monotone polygons.
   // Time complexity: O(n*log(n)), n is the number of vertices.
   // Space complexity: O(n)
@@ -343,6 +1090,18 @@ public:
   // Returns 1 on success, 0 on failure.
   int Triangulate_MONO(TPPLPoly *poly, TPPLPolyList *triangles);
 
+  // Triangulates a polygon by first partitioning it into monotone polygons,
+  // writing the triangles to an index buffer.
+  // params:
+  //    poly:
+  //       An input polygon to be triangulated.
+  //       Vertices have to be in counter-clockwise order.
+  //    indices:
+  //       Three vertex indices of poly per triangle (result).
+  //       Has to hold 3 * GetNumTriangles(poly) entries.
+  // Returns 1 on success, 0 on failure.
+  int Triangulate_MONO(TPPLPoly *poly, uint32_t *indices);
+
   // Triangulates a list of polygons by first
   // partitioning them into monotone polygons.
   // Time complexity: O(n*log(n)), n is the number of vertices.
@@ -357,6 +1116,63 @@ public:
   // Returns 1 on success, 0 on failure.
   int Triangulate_MONO(TPPLPolyList *inpolys, TPPLPolyList *triangles);
 
+  // Triangulates a list of polygons by first partitioning them into
+  // monotone polygons, writing the triangles to an index buffer.
+  // params:
+  //    inpolys:
+  //       A list of polygons to be triangulated (can contain holes).
+  //       Vertices of all non-hole polys have to be in counter-clockwise order.
+  //       Vertices of all hole polys have to be in clockwise order.
+  //    indices:
+  //       Three vertex indices per triangle (result). Vertices are numbered
+  //       across all polygons in inpolys, in list order.
+  //       Has to hold 3 * GetNumTriangles(inpolys) entries.
+  // Returns 1 on success, 0 on failure.
+  int Triangulate_MONO(TPPLPolyList *inpolys, uint32_t *indices);
+
+  // Improves a triangulation by flipping the diagonals shared by two
+  // triangles until it is locally Delaunay (Lawson's algorithm), which
+  // maximizes the smallest angle without moving the polygon edges. Gives
+  // triangles similar to Triangulate_OPT from the much faster
+  // Triangulate_EC or Triangulate_MONO. Diagonals are only flipped if
+  // the circumcircle test is certain despite rounding errors.
+  // Time complexity: O(n*log(n)) to match the triangle edges, plus
+  // the flips, O(n) typically and O(n^2) worst case, n is the number of
+  // triangles.
+  // Space complexity: O(n)
+  // params:
+  //    triangles:
+  //       A list of triangles, with vertices in counter-clockwise
+  //       order, as produced by the triangulation methods. Triangles are
+  //       adjacent where their vertices are equal, so triangles of
+  //       polygons that share an edge can be flipped across it.
+  //       Overwritten by the result.
+  // Returns 1 on success, 0 if a polygon is not a triangle.
+  int FlipToDelaunay(TPPLPolyList *triangles);
+
+  // Same as above, for triangles in an index buffer.
+  // params:
+  //    poly:
+  //       The triangulated polygon.
+  //    indices:
+  //       Three vertex indices of poly per triangle, for example from
+  //       Triangulate_EC. Holds 3 * GetNumTriangles(poly) entries.
+  //       Overwritten by the result.
+  // Returns 1 on success, 0 if an index is out of range.
+  int FlipToDelaunay(TPPLPoly *poly, uint32_t *indices);
+
+  // Same as above, for an index buffer of a list of polygons.
+  // params:
+  //    inpolys:
+  //       The triangulated polygons.
+  //    indices:
+  //       Three vertex indices per triangle, numbered across all polygons
+  //       in inpolys in list order, for example from Triangulate_MONO.
+  //       Holds 3 * GetNumTriangles(inpolys) entries.
+  //       Overwritten by the result.
+  // Returns 1 on success, 0 if an index is out of range.
+  int FlipToDelaunay(TPPLPolyList *inpolys, uint32_t *indices);
+
   // Creates a monotone partition of a list of polygons that
   // can contain holes. Triangulates a set of polygons by
   // first partitioning them into monotone polygons.
@@ -372,12 +1188,26 @@ public:
   // Returns 1 on success, 0 on failure.
   int MonotonePartition(TPPLPolyList *inpolys, TPPLPolyList *monotonePolys);
 
+  // Same as above, but stores the monotone polygons as point indices
+  // in a single array, without creating a TPPLPoly for each of them.
+  // params:
+  //    inpolys:
+  //       A list of polygons to be triangulated (can contain holes).
+  //       Vertices of all non-hole polys have to be in counter-clockwise order.
+  //       Vertices of all hole polys have to be in clockwise order.
+  //    pieces:
+  //       The monotone polygons (result).
+  // Returns 1 on success, 0 on failure.
+  int MonotonePartition(TPPLPolyList *inpolys, TPPLMonotonePieces *pieces);
+
   // Partitions a polygon into convex polygons by using the
   // Hertel-Mehlhorn algorithm. The algorithm gives at most four times
   // the number of parts as the optimal algorithm, however, in practice
   // it works much better than that and often gives optimal partition.
-  // It uses triangulation obtained by ear clipping as intermediate result.
-  // Time complexity O(n^2), n is the number of vertices.
+  // It uses triangulation obtained by ear clipping as intermediate result,
+  // and removes the diagonals in a single pass over the triangles.
+  // Time complexity: that of Triangulate_EC, plus O(n*log(n)) to match
+  // the triangle edges, n is the number of vertices.
   // Space complexity: O(n)
   // params:
   //    poly:
@@ -392,8 +1222,10 @@ public:
   // Hertel-Mehlhorn algorithm. The algorithm gives at most four times
   // the number of parts as the optimal algorithm, however, in practice
   // it works much better than that and often gives optimal partition.
-  // It uses triangulation obtained by ear clipping as intermediate result.
-  // Time complexity O(n^2), n is the number of vertices.
+  // It uses triangulation obtained by ear clipping as intermediate result,
+  // and removes the diagonals in a single pass over the triangles.
+  // Time complexity: that of Triangulate_EC, plus O(n*log(n)) to match
+  // the triangle edges, n is the number of vertices.
   // Space complexity: O(n)
   // params:
   //    inpolys:
@@ -417,8 +1249,27 @@ public:
   //       Vertices have to be in counter-clockwise order.
   //    parts:
   //       Resulting list of convex polygons.
-  // Returns 1 on success, 0 on failure.
+  // Returns 1 on success, 0 on failure. A triangle is returned as the
+  // only part, like in ConvexPartition_HM.
   int ConvexPartition_OPT(TPPLPoly *poly, TPPLPolyList *parts);
+
+  // Same as above, but reports whether the partition is optimal, or
+  // was created by ConvexPartition_HM because the optimal algorithm
+  // would have exceeded the limit set with SetMemoryLimit.
+  // params:
+  //    poly:
+  //       An input polygon to be partitioned.
+  //       Vertices have to be in counter-clockwise order.
+  //    parts:
+  //       Resulting list of convex polygons.
+  //    optimal:
+  //       Set to true if the optimal algorithm was used (result).
+  // Returns 1 on success, 0 on failure.
+  int ConvexPartition_OPT(TPPLPoly *poly, TPPLPolyList *parts, bool *optimal);
 };
 
+#ifdef TPPL_NAMESPACE
+}
+#endif
+
 #endif
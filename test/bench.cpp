@@ -0,0 +1,427 @@
+/*************************************************************************/
+/* Copyright (c) 2011-2021 Ivan Fratric and contributors.                */
+/*                                                                       */
+/* Permission is hereby granted, free of charge, to any person obtaining */
+/* a copy of this software and associated documentation files (the       */
+/* "Software"), to deal in the Software without restriction, including   */
+/* without limitation the rights to use, copy, modify, merge, publish,   */
+/* distribute, sublicense, and/or sell copies of the Software, and to    */
+/* permit persons to whom the Software is furnished to do so, subject to */
+/* the following conditions:                                             */
+/*                                                                       */
+/* The above copyright notice and this permission notice shall be        */
+/* included in all copies or substantial portions of the Software.       */
+/*                                                                       */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,       */
+/* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF    */
+/* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.*/
+/* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY  */
+/* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,  */
+/* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE     */
+/* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.                */
+/*************************************************************************/
+
+// Times the partitioning algorithms on generated polygons of growing size.
+//
+// Usage: polypartition_bench [maxvertices] [repetitions] [seed]
+//
+// Results are printed and written to bench_output.txt, one line per
+// family, algorithm and size: median and 99th percentile time of the
+// repetitions, vertices per second at the median, and the peak resident
+// memory during the runs.
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <chrono>
+#include <list>
+#include <random>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+using namespace std;
+
+#include "polypartition.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// A single run stops a family from growing for that algorithm
+// once it takes longer than this, in seconds.
+#define BENCH_TIME_LIMIT 2.0
+// Repetitions are reduced so that a size takes about this long.
+#define BENCH_SIZE_TIME 5.0
+
+enum BenchAlgorithm {
+  BENCH_TRIANGULATE_EC,
+  BENCH_TRIANGULATE_OPT,
+  BENCH_TRIANGULATE_MONO,
+  BENCH_CONVEXPARTITION_HM,
+  BENCH_CONVEXPARTITION_OPT,
+  BENCH_NUM_ALGORITHMS
+};
+
+const char *algorithmnames[BENCH_NUM_ALGORITHMS] = {
+  "Triangulate_EC",
+  "Triangulate_OPT",
+  "Triangulate_MONO",
+  "ConvexPartition_HM",
+  "ConvexPartition_OPT"
+};
+
+// Largest input for each algorithm, so that the O(n^3) ones do not
+// dominate the run time.
+const long algorithmlimits[BENCH_NUM_ALGORITHMS] = {
+  1000000,
+  1000,
+  1000000,
+  1000000,
+  1000
+};
+
+// Star shaped polygon with random radii.
+void GenerateStar(long n, mt19937 *rng, TPPLPolyList *polys) {
+  uniform_real_distribution<double> radius(0.3, 1.0);
+  TPPLPoly poly;
+  long i;
+
+  poly.Init(n);
+  for (i = 0; i < n; i++) {
+    double angle = 2 * M_PI * i / n;
+    double r = radius(*rng);
+    poly[i].x = r * cos(angle);
+    poly[i].y = r * sin(angle);
+  }
+  polys->push_back(poly);
+}
+
+// Band wound into an Archimedean spiral, with about 50 points per turn
+// on each side.
+void GenerateSpiral(long n, mt19937 *rng, TPPLPolyList *polys) {
+  uniform_real_distribution<double> jitter(-0.05, 0.05);
+  TPPLPoly poly;
+  long i, half;
+  double turns, angle, r;
+
+  half = n / 2;
+  turns = std::max(1.0, half / 50.0);
+  poly.Init(2 * half);
+  for (i = 0; i < half; i++) {
+    angle = 2 * M_PI * turns * i / std::max(1L, half - 1);
+    r = 1 + angle / (2 * M_PI) + 0.25 + jitter(*rng);
+    poly[i].x = r * cos(angle);
+    poly[i].y = r * sin(angle);
+    r = 1 + angle / (2 * M_PI) - 0.25 + jitter(*rng);
+    poly[2 * half - 1 - i].x = r * cos(angle);
+    poly[2 * half - 1 - i].y = r * sin(angle);
+  }
+  polys->push_back(poly);
+}
+
+// Comb with teeth and gaps of random height.
+void GenerateComb(long n, mt19937 *rng, TPPLPolyList *polys) {
+  uniform_real_distribution<double> height(2.0, 10.0);
+  uniform_real_distribution<double> gap(0.5, 1.5);
+  TPPLPoly poly;
+  long i, numteeth;
+  double h;
+
+  numteeth = std::max(1L, (n - 2) / 4);
+  poly.Init(4 * numteeth + 2);
+  poly[0].x = 0;
+  poly[0].y = 0;
+  poly[1].x = 2 * numteeth;
+  poly[1].y = 0;
+  for (i = 0; i < numteeth; i++) {
+    h = height(*rng);
+    poly[4 * i + 2].x = 2 * (numteeth - i);
+    poly[4 * i + 2].y = h;
+    poly[4 * i + 3].x = 2 * (numteeth - i) - 1;
+    poly[4 * i + 3].y = h;
+    poly[4 * i + 4].x = 2 * (numteeth - i) - 1;
+    poly[4 * i + 4].y = gap(*rng);
+    poly[4 * i + 5].x = 2 * (numteeth - i) - 2;
+    poly[4 * i + 5].y = gap(*rng);
+  }
+  polys->push_back(poly);
+}
+
+// Star shaped polygon whose radius follows a random walk, similar
+// to a building or parcel footprint.
+void GenerateRandomWalk(long n, mt19937 *rng, TPPLPolyList *polys) {
+  normal_distribution<double> step(0.0, 0.02);
+  TPPLPoly poly;
+  long i;
+  double r = 1;
+
+  poly.Init(n);
+  for (i = 0; i < n; i++) {
+    double angle = 2 * M_PI * i / n;
+    r = std::max(0.2, std::min(2.0, r + step(*rng)));
+    poly[i].x = r * cos(angle);
+    poly[i].y = r * sin(angle);
+  }
+  polys->push_back(poly);
+}
+
+// Square with a grid of small square holes at random positions in
+// their cells, 1 to 10000 holes of 4 points each. The remaining points
+// subdivide the edges of the square.
+void GenerateHoles(long n, mt19937 *rng, TPPLPolyList *polys) {
+  uniform_real_distribution<double> offset(0.1, 0.5);
+  TPPLPoly outer, hole;
+  long i, side, numholes, numouter, gridsize;
+  double t, x, y;
+
+  numholes = std::max(1L, std::min(10000L, n / 8));
+  numouter = std::max(4L, n - 4 * numholes) / 4 * 4;
+  gridsize = (long)ceil(sqrt((double)numholes));
+
+  outer.Init(numouter);
+  for (i = 0; i < numouter; i++) {
+    side = i / (numouter / 4);
+    t = (double)(i % (numouter / 4)) / (numouter / 4) * gridsize;
+    switch (side) {
+      case 0:
+        outer[i].x = t;
+        outer[i].y = 0;
+        break;
+      case 1:
+        outer[i].x = gridsize;
+        outer[i].y = t;
+        break;
+      case 2:
+        outer[i].x = gridsize - t;
+        outer[i].y = gridsize;
+        break;
+      default:
+        outer[i].x = 0;
+        outer[i].y = gridsize - t;
+        break;
+    }
+  }
+  polys->push_back(outer);
+
+  hole.Init(4);
+  hole.SetHole(true);
+  for (i = 0; i < numholes; i++) {
+    x = i % gridsize + offset(*rng);
+    y = i / gridsize + offset(*rng);
+    hole[0].x = x;
+    hole[0].y = y;
+    hole[1].x = x;
+    hole[1].y = y + 0.4;
+    hole[2].x = x + 0.4;
+    hole[2].y = y + 0.4;
+    hole[3].x = x + 0.4;
+    hole[3].y = y;
+    polys->push_back(hole);
+  }
+}
+
+struct BenchFamily {
+  const char *name;
+  void (*generate)(long n, mt19937 *rng, TPPLPolyList *polys);
+  bool holes;
+};
+
+const BenchFamily families[] = {
+  { "star", GenerateStar, false },
+  { "spiral", GenerateSpiral, false },
+  { "comb", GenerateComb, false },
+  { "randomwalk", GenerateRandomWalk, false },
+  { "holes", GenerateHoles, true },
+};
+
+long CountPoints(TPPLPolyList *polys) {
+  TPPLPolyList::iterator iter;
+  long n = 0;
+  for (iter = polys->begin(); iter != polys->end(); iter++) {
+    n += iter->GetNumPoints();
+  }
+  return n;
+}
+
+// Resets the peak resident memory where the system allows it.
+void ResetPeakMemory() {
+#if defined(__linux__)
+  FILE *fp = fopen("/proc/self/clear_refs", "w");
+  if (fp) {
+    fprintf(fp, "5\n");
+    fclose(fp);
+  }
+#endif
+}
+
+// Returns the peak resident memory of the process in bytes.
+double GetPeakMemory() {
+#if defined(_WIN32)
+  PROCESS_MEMORY_COUNTERS counters;
+  if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+    return (double)counters.PeakWorkingSetSize;
+  }
+  return 0;
+#else
+#if defined(__linux__)
+  FILE *fp = fopen("/proc/self/status", "r");
+  char line[256];
+  long kb;
+  if (fp) {
+    while (fgets(line, sizeof(line), fp)) {
+      if (sscanf(line, "VmHWM: %ld", &kb) == 1) {
+        fclose(fp);
+        return kb * 1024.0;
+      }
+    }
+    fclose(fp);
+  }
+#endif
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+#if defined(__APPLE__)
+  return (double)usage.ru_maxrss;
+#else
+  return usage.ru_maxrss * 1024.0;
+#endif
+#endif
+}
+
+// Runs the algorithm once, returns the time in seconds or -1 on failure.
+double Run(TPPLPartition *pp, BenchAlgorithm algorithm, TPPLPolyList *polys) {
+  TPPLPolyList result;
+  chrono::steady_clock::time_point start;
+  int ret = 0;
+
+  start = chrono::steady_clock::now();
+  switch (algorithm) {
+    case BENCH_TRIANGULATE_EC:
+      ret = pp->Triangulate_EC(polys, &result);
+      break;
+    case BENCH_TRIANGULATE_OPT:
+      ret = pp->Triangulate_OPT(&polys->front(), &result);
+      break;
+    case BENCH_TRIANGULATE_MONO:
+      ret = pp->Triangulate_MONO(polys, &result);
+      break;
+    case BENCH_CONVEXPARTITION_HM:
+      ret = pp->ConvexPartition_HM(polys, &result);
+      break;
+    case BENCH_CONVEXPARTITION_OPT:
+      ret = pp->ConvexPartition_OPT(&polys->front(), &result);
+      break;
+    default:
+      break;
+  }
+  if (!ret) {
+    return -1;
+  }
+  return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+// Returns the p-th percentile of sorted times, by the nearest rank.
+double Percentile(vector<double> *times, double p) {
+  long rank = (long)ceil(p / 100 * times->size());
+  return (*times)[std::max(0L, std::min(rank, (long)times->size()) - 1)];
+}
+
+int main(int argc, char *argv[]) {
+  long maxvertices = 1000000;
+  long repetitions = 10;
+  unsigned long seed = 1;
+  long n, numpoints, i, reps;
+  int family, algorithm;
+  double warmup, time, peak;
+  bool stopped[sizeof(families) / sizeof(families[0])][BENCH_NUM_ALGORITHMS] = {};
+  vector<double> times;
+  TPPLPartition pp;
+  TPPLPolyList polys;
+  FILE *out;
+  char line[256];
+
+  if (argc > 1) {
+    maxvertices = atol(argv[1]);
+  }
+  if (argc > 2) {
+    repetitions = std::max(1L, atol(argv[2]));
+  }
+  if (argc > 3) {
+    seed = strtoul(argv[3], NULL, 10);
+  }
+
+  out = fopen("bench_output.txt", "w");
+  if (!out) {
+    printf("Error writing file bench_output.txt\n");
+    return 1;
+  }
+  snprintf(line, sizeof(line), "%-12s %-20s %9s %5s %12s %12s %14s %10s\n",
+          "family", "algorithm", "vertices", "reps", "p50 (ms)", "p99 (ms)", "vertices/s", "peak (MB)");
+  printf("%s", line);
+  fprintf(out, "%s", line);
+
+  for (n = 10; n <= maxvertices; n *= 10) {
+    for (family = 0; family < (int)(sizeof(families) / sizeof(families[0])); family++) {
+      polys.clear();
+      mt19937 rng((unsigned int)(seed * 1000003 + family * 101 + n));
+      families[family].generate(n, &rng, &polys);
+      numpoints = CountPoints(&polys);
+
+      for (algorithm = 0; algorithm < BENCH_NUM_ALGORITHMS; algorithm++) {
+        if (stopped[family][algorithm] || (n > algorithmlimits[algorithm])) {
+          continue;
+        }
+        // The optimal algorithms do not support holes.
+        if (families[family].holes &&
+                ((algorithm == BENCH_TRIANGULATE_OPT) || (algorithm == BENCH_CONVEXPARTITION_OPT))) {
+          continue;
+        }
+
+        ResetPeakMemory();
+        times.clear();
+        warmup = Run(&pp, (BenchAlgorithm)algorithm, &polys);
+        if (warmup < 0) {
+          snprintf(line, sizeof(line), "%-12s %-20s %9ld failed\n",
+                  families[family].name, algorithmnames[algorithm], numpoints);
+          printf("%s", line);
+          fprintf(out, "%s", line);
+          continue;
+        }
+        if (warmup > BENCH_TIME_LIMIT) {
+          // Too slow to repeat, the warmup is the only sample.
+          stopped[family][algorithm] = true;
+          times.push_back(warmup);
+        } else {
+          reps = std::max(1L, std::min(repetitions, (long)(BENCH_SIZE_TIME / std::max(warmup, 1e-9))));
+          for (i = 0; i < reps; i++) {
+            time = Run(&pp, (BenchAlgorithm)algorithm, &polys);
+            if (time >= 0) {
+              times.push_back(time);
+            }
+          }
+        }
+        peak = GetPeakMemory();
+        sort(times.begin(), times.end());
+
+        snprintf(line, sizeof(line), "%-12s %-20s %9ld %5ld %12.4f %12.4f %14.0f %10.1f\n",
+                families[family].name, algorithmnames[algorithm], numpoints, (long)times.size(),
+                Percentile(&times, 50) * 1000, Percentile(&times, 99) * 1000,
+                numpoints / std::max(Percentile(&times, 50), 1e-9), peak / (1024 * 1024));
+        printf("%s", line);
+        fprintf(out, "%s", line);
+        fflush(out);
+      }
+    }
+  }
+
+  fclose(out);
+  return 0;
+}
@@ -0,0 +1,461 @@
+/*************************************************************************/
+/* Copyright (c) 2011-2021 Ivan Fratric and contributors.                */
+/*                                                                       */
+/* Permission is hereby granted, free of charge, to any person obtaining */
+/* a copy of this software and associated documentation files (the       */
+/* "Software"), to deal in the Software without restriction, including   */
+/* without limitation the rights to use, copy, modify, merge, publish,   */
+/* distribute, sublicense, and/or sell copies of the Software, and to    */
+/* permit persons to whom the Software is furnished to do so, subject to */
+/* the following conditions:                                             */
+/*                                                                       */
+/* The above copyright notice and this permission notice shall be        */
+/* included in all copies or substantial portions of the Software.       */
+/*                                                                       */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,       */
+/* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF    */
+/* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.*/
+/* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY  */
+/* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,  */
+/* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE     */
+/* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.                */
+/*************************************************************************/
+
+// Partitions a stream of polygon records with one of the algorithms.
+//
+// Usage: polypartition_cli [-a algorithm] [-j threads] [-q records]
+//                          [input [output]]
+//
+// algorithm is one of Triangulate_EC (the default), Triangulate_OPT,
+// Triangulate_MONO, ConvexPartition_HM and ConvexPartition_OPT. Input and
+// output default to stdin and stdout, "-" selects them explicitly.
+//
+// Every record is a polygon list in the text format of the test files:
+// the number of polygons, then for each polygon its number of points,
+// 1 if it is a hole or 0 otherwise, and its points as "x y" pairs. A
+// record is partitioned as a whole, so holes go into the same record as
+// the polygon containing them. Records are simply concatenated. For every
+// input record, the resulting polygons are written as a record of the
+// same format, in input order. Records that fail to partition are written
+// as empty lists and reported on stderr.
+//
+// The records go through a pipeline: the main thread parses them, worker
+// threads (one per hardware thread by default) partition them, and
+// another thread writes them. At most "records" of them (4 per worker by
+// default) are in the pipeline at any time, so memory use doesn't grow
+// with the size of the input.
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <condition_variable>
+#include <list>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+#include "polypartition.h"
+
+// Largest number of polygons or points accepted in a record. Points are
+// numbered with uint32_t in index buffers.
+#define CLI_MAX_COUNT 4294967295.0
+
+enum CliAlgorithm {
+  CLI_TRIANGULATE_EC,
+  CLI_TRIANGULATE_OPT,
+  CLI_TRIANGULATE_MONO,
+  CLI_CONVEXPARTITION_HM,
+  CLI_CONVEXPARTITION_OPT,
+  CLI_NUM_ALGORITHMS
+};
+
+const char *algorithmnames[CLI_NUM_ALGORITHMS] = {
+  "Triangulate_EC",
+  "Triangulate_OPT",
+  "Triangulate_MONO",
+  "ConvexPartition_HM",
+  "ConvexPartition_OPT"
+};
+
+// Reads whitespace separated numbers through a buffer of its own,
+// which is a lot faster than fscanf.
+class NumberReader {
+  FILE *fp;
+  char buffer[65536];
+  size_t pos, end;
+
+  public:
+  NumberReader(FILE *fp) :
+          fp(fp), pos(0), end(0) {}
+
+  // Returns the next character, or EOF.
+  int Next() {
+    if (pos == end) {
+      end = fread(buffer, 1, sizeof(buffer), fp);
+      pos = 0;
+      if (end == 0) {
+        return EOF;
+      }
+    }
+    return (unsigned char)buffer[pos++];
+  }
+
+  // Reads a number into value.
+  // Returns 1 on success, 0 at the end of the input and -1 if the
+  // next word is not a number.
+  int Read(double *value) {
+    char token[64];
+    char *tokenend;
+    int c, length;
+
+    do {
+      c = Next();
+    } while ((c == ' ') || (c == '\t') || (c == '\n') || (c == '\r'));
+
+    length = 0;
+    while ((c != EOF) && (c != ' ') && (c != '\t') && (c != '\n') && (c != '\r')) {
+      if (length == (int)sizeof(token) - 1) {
+        return -1;
+      }
+      token[length++] = (char)c;
+      c = Next();
+    }
+    if (length == 0) {
+      return 0;
+    }
+    token[length] = 0;
+    *value = strtod(token, &tokenend);
+    return (*tokenend == 0) ? 1 : -1;
+  }
+};
+
+// Reads a record into polys.
+// Returns 1 on success, 0 at the end of the input and -1 if the
+// record is malformed.
+int ReadRecord(NumberReader *reader, TPPLPolyList *polys) {
+  double numpolys, numpoints, hole, x, y;
+  TPPLPoly poly;
+  long i, j;
+  int ret;
+
+  ret = reader->Read(&numpolys);
+  if (ret <= 0) {
+    return ret;
+  }
+  if ((numpolys < 0) || (numpolys > CLI_MAX_COUNT) || (numpolys != (long)numpolys)) {
+    return -1;
+  }
+  for (i = 0; i < (long)numpolys; i++) {
+    if ((reader->Read(&numpoints) != 1) || (reader->Read(&hole) != 1) || (numpoints < 0) ||
+            (numpoints > CLI_MAX_COUNT) || (numpoints != (long)numpoints)) {
+      return -1;
+    }
+    // The count is not checked against the input yet, so it can still
+    // be too large to allocate.
+    try {
+      poly.Init((long)numpoints);
+    } catch (const bad_alloc &) {
+      return -1;
+    }
+    poly.SetHole(hole != 0);
+    for (j = 0; j < (long)numpoints; j++) {
+      if ((reader->Read(&x) != 1) || (reader->Read(&y) != 1)) {
+        return -1;
+      }
+      poly.GetPoint(j).x = x;
+      poly.GetPoint(j).y = y;
+#if TPPL_POINT_ID
+      poly.GetPoint(j).id = 0;
+#endif
+    }
+    polys->push_back(std::move(poly));
+  }
+  return 1;
+}
+
+// Returns 0 if writing failed.
+int WriteRecord(FILE *fp, TPPLPolyList *polys) {
+  TPPLPolyList::iterator iter;
+  long i;
+
+  fprintf(fp, "%ld\n", (long)polys->size());
+  for (iter = polys->begin(); iter != polys->end(); iter++) {
+    fprintf(fp, "%ld\n%d\n", iter->GetNumPoints(), iter->IsHole() ? 1 : 0);
+    for (i = 0; i < iter->GetNumPoints(); i++) {
+      fprintf(fp, "%.17g %.17g\n", (double)iter->GetPoint(i).x, (double)iter->GetPoint(i).y);
+    }
+  }
+  return ferror(fp) ? 0 : 1;
+}
+
+int Partition(TPPLPartition *pp, CliAlgorithm algorithm, TPPLPolyList *polys, TPPLPolyList *result) {
+  TPPLPolyList::iterator iter;
+
+  switch (algorithm) {
+    case CLI_TRIANGULATE_EC:
+      return pp->Triangulate_EC(polys, result);
+    case CLI_TRIANGULATE_MONO:
+      return pp->Triangulate_MONO(polys, result);
+    case CLI_CONVEXPARTITION_HM:
+      return pp->ConvexPartition_HM(polys, result);
+    default:
+      break;
+  }
+
+  // The optimal algorithms take single polygons without holes.
+  for (iter = polys->begin(); iter != polys->end(); iter++) {
+    if (iter->IsHole()) {
+      return 0;
+    }
+    if (algorithm == CLI_TRIANGULATE_OPT) {
+      if (!pp->Triangulate_OPT(&(*iter), result)) {
+        return 0;
+      }
+    } else if (!pp->ConvexPartition_OPT(&(*iter), result)) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// A record in the pipeline.
+struct Record {
+  TPPLPolyList polys;
+  TPPLPolyList result;
+  int ret;
+  bool done;
+};
+
+// Records numwritten ... numparsed - 1 are in the pipeline, record i in
+// slot i % capacity. Records numwritten ... numtaken - 1 have been
+// handed to the workers.
+struct Pipeline {
+  Record *records;
+  long capacity;
+  long numparsed, numtaken, numwritten;
+  bool endofinput;
+  bool writefailed;
+  long numfailed;
+  mutex lock;
+  condition_variable changed;
+};
+
+void Work(Pipeline *pipeline, CliAlgorithm algorithm) {
+  TPPLPartition pp;
+  TPPLWorkspace workspace;
+  Record *record;
+  long index;
+
+  pp.SetWorkspace(&workspace);
+  for (;;) {
+    {
+      unique_lock<mutex> guard(pipeline->lock);
+      pipeline->changed.wait(guard, [pipeline]() {
+        return (pipeline->numtaken < pipeline->numparsed) || pipeline->endofinput;
+      });
+      if (pipeline->numtaken == pipeline->numparsed) {
+        return;
+      }
+      index = pipeline->numtaken++;
+    }
+
+    record = &(pipeline->records[index % pipeline->capacity]);
+    record->ret = Partition(&pp, algorithm, &record->polys, &record->result);
+    if (!record->ret) {
+      record->result.clear();
+    }
+    record->polys.clear();
+
+    {
+      lock_guard<mutex> guard(pipeline->lock);
+      record->done = true;
+    }
+    pipeline->changed.notify_all();
+  }
+}
+
+void Write(Pipeline *pipeline, FILE *fp) {
+  Record *record;
+  long index;
+
+  for (;;) {
+    {
+      unique_lock<mutex> guard(pipeline->lock);
+      pipeline->changed.wait(guard, [pipeline]() {
+        return ((pipeline->numwritten < pipeline->numparsed) &&
+                       pipeline->records[pipeline->numwritten % pipeline->capacity].done) ||
+                (pipeline->endofinput && (pipeline->numwritten == pipeline->numparsed));
+      });
+      if (pipeline->numwritten == pipeline->numparsed) {
+        return;
+      }
+      index = pipeline->numwritten;
+    }
+
+    record = &(pipeline->records[index % pipeline->capacity]);
+    if (!record->ret) {
+      fprintf(stderr, "Record %ld failed to partition\n", index);
+    }
+    if (!pipeline->writefailed && !WriteRecord(fp, &record->result)) {
+      fprintf(stderr, "Error writing the output\n");
+      pipeline->writefailed = true;
+    }
+    record->result.clear();
+
+    {
+      lock_guard<mutex> guard(pipeline->lock);
+      if (!record->ret) {
+        pipeline->numfailed++;
+      }
+      record->done = false;
+      pipeline->numwritten++;
+    }
+    pipeline->changed.notify_all();
+  }
+}
+
+int main(int argc, char *argv[]) {
+  CliAlgorithm algorithm = CLI_TRIANGULATE_EC;
+  long numthreads = 0, capacity = 0;
+  const char *inputname = "-", *outputname = "-";
+  FILE *in, *out;
+  Pipeline pipeline;
+  vector<thread> workers;
+  thread writer;
+  Record *record;
+  int i, a, numfiles, ret;
+  bool malformed;
+
+  numfiles = 0;
+  for (i = 1; i < argc; i++) {
+    if ((strcmp(argv[i], "-a") == 0) && (i + 1 < argc)) {
+      i++;
+      for (a = 0; a < CLI_NUM_ALGORITHMS; a++) {
+        if (strcmp(argv[i], algorithmnames[a]) == 0) {
+          break;
+        }
+      }
+      if (a == CLI_NUM_ALGORITHMS) {
+        fprintf(stderr, "Unknown algorithm %s\n", argv[i]);
+        return 1;
+      }
+      algorithm = (CliAlgorithm)a;
+    } else if ((strcmp(argv[i], "-j") == 0) && (i + 1 < argc)) {
+      numthreads = atol(argv[++i]);
+    } else if ((strcmp(argv[i], "-q") == 0) && (i + 1 < argc)) {
+      capacity = atol(argv[++i]);
+    } else if ((argv[i][0] != '-' || argv[i][1] == 0) && (numfiles < 2)) {
+      if (numfiles == 0) {
+        inputname = argv[i];
+      } else {
+        outputname = argv[i];
+      }
+      numfiles++;
+    } else {
+      fprintf(stderr, "Usage: %s [-a algorithm] [-j threads] [-q records] [input [output]]\n", argv[0]);
+      return 1;
+    }
+  }
+  if (numthreads <= 0) {
+    numthreads = std::max(1L, (long)thread::hardware_concurrency());
+  }
+  if (capacity <= 0) {
+    capacity = 4 * numthreads;
+  }
+
+  in = stdin;
+  if (strcmp(inputname, "-") != 0) {
+    in = fopen(inputname, "rb");
+    if (!in) {
+      fprintf(stderr, "Error reading file %s\n", inputname);
+      return 1;
+    }
+  }
+  out = stdout;
+  if (strcmp(outputname, "-") != 0) {
+    out = fopen(outputname, "w");
+    if (!out) {
+      fprintf(stderr, "Error writing file %s\n", outputname);
+      return 1;
+    }
+  }
+
+  pipeline.records = new Record[capacity];
+  pipeline.capacity = capacity;
+  pipeline.numparsed = 0;
+  pipeline.numtaken = 0;
+  pipeline.numwritten = 0;
+  pipeline.endofinput = false;
+  pipeline.writefailed = false;
+  pipeline.numfailed = 0;
+  for (i = 0; i < capacity; i++) {
+    pipeline.records[i].done = false;
+  }
+
+  for (i = 0; i < numthreads; i++) {
+    workers.push_back(thread(Work, &pipeline, algorithm));
+  }
+  writer = thread(Write, &pipeline, out);
+
+  // Parse records as long as there is room in the pipeline.
+  NumberReader reader(in);
+  malformed = false;
+  for (;;) {
+    {
+      unique_lock<mutex> guard(pipeline.lock);
+      pipeline.changed.wait(guard, [&pipeline]() {
+        return pipeline.numparsed - pipeline.numwritten < pipeline.capacity;
+      });
+    }
+
+    record = &(pipeline.records[pipeline.numparsed % capacity]);
+    ret = ReadRecord(&reader, &record->polys);
+    if (ret < 0) {
+      fprintf(stderr, "Record %ld is malformed\n", pipeline.numparsed);
+      malformed = true;
+      record->polys.clear();
+    }
+    if (ret <= 0) {
+      break;
+    }
+
+    {
+      lock_guard<mutex> guard(pipeline.lock);
+      pipeline.numparsed++;
+    }
+    pipeline.changed.notify_all();
+  }
+
+  {
+    lock_guard<mutex> guard(pipeline.lock);
+    pipeline.endofinput = true;
+  }
+  pipeline.changed.notify_all();
+  for (i = 0; i < numthreads; i++) {
+    workers[i].join();
+  }
+  writer.join();
+
+  if (in != stdin) {
+    fclose(in);
+  }
+  if (out != stdout) {
+    if (fclose(out) != 0) {
+      pipeline.writefailed = true;
+    }
+  } else if (fflush(out) != 0) {
+    pipeline.writefailed = true;
+  }
+  if (pipeline.numfailed > 0) {
+    fprintf(stderr, "%ld of %ld records failed to partition\n", pipeline.numfailed, pipeline.numwritten);
+  }
+  delete[] pipeline.records;
+
+  return (malformed || pipeline.writefailed || (pipeline.numfailed > 0)) ? 1 : 0;
+}
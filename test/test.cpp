@@ -23,9 +23,15 @@
 
 #define _CRT_SECURE_NO_WARNINGS
 
+#include <math.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
 #include <limits>
 #include <list>
+#include <map>
+#include <new>
+#include <vector>
 
 using namespace std;
 
@@ -34,6 +40,28 @@ using namespace std;
 #include "image.h"
 #include "imageio.h"
 
+// Counts the calls to operator new and operator delete, to check that
+// calls with a workspace allocate no scratch memory, and that clearing
+// the workspace frees it. Threads started by the tests allocate too.
+static atomic<long> numallocations(0);
+static atomic<long> numfrees(0);
+
+void *operator new(size_t size) {
+  void *p = malloc(size > 0 ? size : 1);
+  if (!p) {
+    throw bad_alloc();
+  }
+  numallocations++;
+  return p;
+}
+
+void operator delete(void *p) noexcept {
+  if (p) {
+    numfrees++;
+  }
+  free(p);
+}
+
 void ReadPoly(FILE *fp, TPPLPoly *poly) {
   int i, numpoints, hole;
   float x, y;
@@ -275,6 +303,101 @@ bool ComparePoly(list<TPPLPoly> *polys1, list<TPPLPoly> *polys2) {
   return true;
 }
 
+// Converts an index buffer into a list of triangles. Indices refer to
+// the vertices of all polygons in polys, in list order.
+void IndicesToPolyList(list<TPPLPoly> *polys, uint32_t *indices, long numtriangles, list<TPPLPoly> *triangles) {
+  list<TPPLPoly>::iterator iter;
+  vector<TPPLPoint> points;
+  TPPLPoly triangle;
+  long i;
+
+  for (iter = polys->begin(); iter != polys->end(); iter++) {
+    for (i = 0; i < iter->GetNumPoints(); i++) {
+      points.push_back(iter->GetPoint(i));
+    }
+  }
+  for (i = 0; i < numtriangles; i++) {
+    triangle.Triangle(points[indices[3 * i]], points[indices[3 * i + 1]], points[indices[3 * i + 2]]);
+    triangles->push_back(triangle);
+  }
+}
+
+// Returns the total signed area of polys, holes have negative area.
+tppl_float GetArea(list<TPPLPoly> *polys) {
+  list<TPPLPoly>::iterator iter;
+  tppl_float area = 0;
+  long i, n;
+
+  for (iter = polys->begin(); iter != polys->end(); iter++) {
+    n = iter->GetNumPoints();
+    for (i = 0; i < n; i++) {
+      area += iter->GetPoint(i).x * iter->GetPoint((i + 1) % n).y - iter->GetPoint((i + 1) % n).x * iter->GetPoint(i).y;
+    }
+  }
+  return area / 2;
+}
+
+// Returns the smallest angle of any triangle in triangles.
+tppl_float GetMinAngle(list<TPPLPoly> *triangles) {
+  list<TPPLPoly>::iterator iter;
+  TPPLPoint v1, v2;
+  tppl_float angle, minangle = 4;
+  long i;
+
+  for (iter = triangles->begin(); iter != triangles->end(); iter++) {
+    for (i = 0; i < 3; i++) {
+      v1 = iter->GetPoint((i + 1) % 3) - iter->GetPoint(i);
+      v2 = iter->GetPoint((i + 2) % 3) - iter->GetPoint(i);
+      angle = atan2(fabs(v1.x * v2.y - v1.y * v2.x), v1.x * v2.x + v1.y * v2.y);
+      minangle = min(minangle, angle);
+    }
+  }
+  return minangle;
+}
+
+// Returns false if, for a diagonal shared by two triangles of an index
+// buffer, the opposite vertex is clearly inside the circumcircle of the
+// other triangle.
+bool IsDelaunay(list<TPPLPoly> *polys, uint32_t *indices, long numtriangles) {
+  list<TPPLPoly>::iterator iter;
+  vector<TPPLPoint> points;
+  map<pair<uint32_t, uint32_t>, long> edges;
+  map<pair<uint32_t, uint32_t>, long>::iterator found;
+  TPPLPoint a, b, c, d;
+  tppl_float det, permanent;
+  long i, e, f;
+
+  for (iter = polys->begin(); iter != polys->end(); iter++) {
+    for (i = 0; i < iter->GetNumPoints(); i++) {
+      points.push_back(iter->GetPoint(i));
+    }
+  }
+  for (e = 0; e < 3 * numtriangles; e++) {
+    edges[make_pair(indices[e], indices[e - e % 3 + (e + 1) % 3])] = e;
+  }
+  for (e = 0; e < 3 * numtriangles; e++) {
+    found = edges.find(make_pair(indices[e - e % 3 + (e + 1) % 3], indices[e]));
+    if (found == edges.end()) {
+      continue;
+    }
+    f = found->second;
+    d = points[indices[f - f % 3 + (f + 2) % 3]];
+    a = points[indices[e]] - d;
+    b = points[indices[e - e % 3 + (e + 1) % 3]] - d;
+    c = points[indices[e - e % 3 + (e + 2) % 3]] - d;
+    det = (a.x * a.x + a.y * a.y) * (b.x * c.y - c.x * b.y) +
+            (b.x * b.x + b.y * b.y) * (c.x * a.y - a.x * c.y) +
+            (c.x * c.x + c.y * c.y) * (a.x * b.y - b.x * a.y);
+    permanent = (a.x * a.x + a.y * a.y) * (fabs(b.x * c.y) + fabs(c.x * b.y)) +
+            (b.x * b.x + b.y * b.y) * (fabs(c.x * a.y) + fabs(a.x * c.y)) +
+            (c.x * c.x + c.y * c.y) * (fabs(a.x * b.y) + fabs(b.x * a.y));
+    if (det > 1e-9 * permanent) {
+      return false;
+    }
+  }
+  return true;
+}
+
 void GenerateTestData() {
   TPPLPartition pp;
 
@@ -318,6 +441,25 @@ void GenerateTestData() {
   pp.ConvexPartition_OPT(&(*testpolys.begin()), &result);
   DrawPolyList("test_convexpartition_OPT.bmp", &result);
   WritePolyList("test_convexpartition_OPT.txt", &result);
+
+  result.clear();
+
+  ReadPolyList("test_degenerate_input.txt", &testpolys);
+
+  pp.Triangulate_EC(&testpolys, &result);
+  WritePolyList("test_degenerate_EC.txt", &result);
+
+  result.clear();
+
+  pp.ConvexPartition_HM(&testpolys, &result);
+  WritePolyList("test_degenerate_HM.txt", &result);
+
+  result.clear();
+
+  ReadPolyList("test_degenerate_monotone_input.txt", &testpolys);
+
+  pp.MonotonePartition(&testpolys, &result);
+  WritePolyList("test_degenerate_monotone.txt", &result);
 }
 
 /*
@@ -339,6 +481,8 @@ int main() {
   TPPLPartition pp;
 
   list<TPPLPoly> testpolys, result, expectedResult;
+  vector<uint32_t> indices;
+  long numtriangles;
 
   ReadPolyList("test_input.txt", &testpolys);
 
@@ -355,6 +499,38 @@ int main() {
   }
   DrawPolyList("tri_ec.bmp", &result);
 
+  result.clear();
+
+  printf("Testing Triangulate_EC with indices: ");
+  numtriangles = TPPLPartition::GetNumTriangles(&testpolys);
+  indices.assign(3 * numtriangles, 0);
+  pp.Triangulate_EC(&testpolys, &indices[0]);
+  IndicesToPolyList(&testpolys, &indices[0], numtriangles, &result);
+  if (ComparePoly(&result, &expectedResult)) {
+    printf("success\n");
+  } else {
+    printf("failed\n");
+    failures++;
+  }
+
+  result.clear();
+
+  // Other ear policies give different triangles, but must still
+  // cover the input exactly.
+  printf("Testing Triangulate_EC with other ear policies: ");
+  pp.SetEarPolicy(TPPL_EARPOLICY_FIRST);
+  pp.Triangulate_EC(&testpolys, &result);
+  pp.SetEarPolicy(TPPL_EARPOLICY_MIN_MAX_ANGLE);
+  pp.Triangulate_EC(&testpolys, &result);
+  pp.SetEarPolicy(TPPL_EARPOLICY_MOST_EXTRUDED);
+  if (((long)result.size() == 2 * TPPLPartition::GetNumTriangles(&testpolys)) &&
+          (fabs(GetArea(&result) - 2 * GetArea(&testpolys)) < 1e-6 * fabs(GetArea(&testpolys)))) {
+    printf("success\n");
+  } else {
+    printf("failed\n");
+    failures++;
+  }
+
   result.clear();
   expectedResult.clear();
 
@@ -369,9 +545,41 @@ int main() {
   }
   DrawPolyList("tri_opt.bmp", &result);
 
+  result.clear();
+
+  printf("Testing Triangulate_OPT with indices: ");
+  numtriangles = TPPLPartition::GetNumTriangles(&(*testpolys.begin()));
+  indices.assign(3 * numtriangles, 0);
+  pp.Triangulate_OPT(&(*testpolys.begin()), &indices[0]);
+  IndicesToPolyList(&testpolys, &indices[0], numtriangles, &result);
+  if (ComparePoly(&result, &expectedResult)) {
+    printf("success\n");
+  } else {
+    printf("failed\n");
+    failures++;
+  }
+
   result.clear();
   expectedResult.clear();
 
+  // Every edge of the optimal triangulation has to be visible.
+  printf("Testing GetVisibilityGraph: ");
+  TPPLVisibilityGraph graph;
+  bool visible = (pp.GetVisibilityGraph(&(*testpolys.begin()), &graph) == 1);
+  for (long i = 0; i < 3 * numtriangles; i++) {
+    uint32_t i1 = indices[i];
+    uint32_t i2 = indices[i - i % 3 + (i + 1) % 3];
+    if (!graph.IsVisible(i1, i2) || !graph.IsVisible(i2, i1)) {
+      visible = false;
+    }
+  }
+  if (visible) {
+    printf("success\n");
+  } else {
+    printf("failed\n");
+    failures++;
+  }
+
   printf("Testing Triangulate_MONO: ");
   pp.Triangulate_MONO(&testpolys, &result);
   ReadPolyList("test_triangulate_MONO.txt", &expectedResult);
@@ -383,6 +591,60 @@ int main() {
   }
   DrawPolyList("tri_mono.bmp", &result);
 
+  result.clear();
+
+  printf("Testing Triangulate_MONO with indices: ");
+  numtriangles = TPPLPartition::GetNumTriangles(&testpolys);
+  indices.assign(3 * numtriangles, 0);
+  pp.Triangulate_MONO(&testpolys, &indices[0]);
+  IndicesToPolyList(&testpolys, &indices[0], numtriangles, &result);
+  if (ComparePoly(&result, &expectedResult)) {
+    printf("success\n");
+  } else {
+    printf("failed\n");
+    failures++;
+  }
+
+  result.clear();
+  expectedResult.clear();
+
+  // Both forms of the monotone partition have to agree.
+  printf("Testing MonotonePartition with pieces: ");
+  TPPLMonotonePieces pieces;
+  pp.MonotonePartition(&testpolys, &pieces);
+  pp.MonotonePartition(&testpolys, &expectedResult);
+  for (long i = 0; i < pieces.GetNumPieces(); i++) {
+    TPPLPoly piece;
+    piece.Init(pieces.GetNumVertices(i));
+    for (long j = 0; j < piece.GetNumPoints(); j++) {
+      piece[j] = pieces.GetPoints()[pieces.GetIndices()[pieces.GetOffsets()[i] + j]];
+    }
+    result.push_back(piece);
+  }
+  if (ComparePoly(&result, &expectedResult)) {
+    printf("success\n");
+  } else {
+    printf("failed\n");
+    failures++;
+  }
+
+  result.clear();
+  expectedResult.clear();
+
+  // Integer polygons with a zero-width spike and vertices touching other
+  // edges, on which the edge order of the sweep depends on ties.
+  printf("Testing MonotonePartition on degenerate input: ");
+  TPPLPolyList monotonepolys;
+  ReadPolyList("test_degenerate_monotone_input.txt", &monotonepolys);
+  ReadPolyList("test_degenerate_monotone.txt", &expectedResult);
+  if (pp.MonotonePartition(&monotonepolys, &result) && ComparePoly(&result, &expectedResult) &&
+          (GetArea(&result) == GetArea(&monotonepolys))) {
+    printf("success\n");
+  } else {
+    printf("failed\n");
+    failures++;
+  }
+
   result.clear();
   expectedResult.clear();
 
@@ -411,5 +673,344 @@ int main() {
   }
   DrawPolyList("conv_opt.bmp", &result);
 
+  result.clear();
+  expectedResult.clear();
+
+  // Without enough memory, the Hertel-Mehlhorn partition is returned.
+  printf("Testing ConvexPartition_OPT with a memory limit: ");
+  bool optimal = true;
+  pp.SetMemoryLimit(1);
+  pp.ConvexPartition_OPT(&(*testpolys.begin()), &result, &optimal);
+  pp.ConvexPartition_HM(&(*testpolys.begin()), &expectedResult);
+  if (!optimal && ComparePoly(&result, &expectedResult)) {
+    printf("success\n");
+  } else {
+    printf("failed\n");
+    failures++;
+  }
+  pp.SetMemoryLimit(0);
+
+  result.clear();
+  expectedResult.clear();
+
+  // A triangle is already convex, with or without the fallback.
+  printf("Testing ConvexPartition_OPT on a triangle: ");
+  TPPLPoly triangle;
+  TPPLPolyList triangleparts;
+  triangle.Triangle(testpolys.front()[0], testpolys.front()[1], testpolys.front()[2]);
+  if (triangle.GetOrientation() != TPPL_ORIENTATION_CCW) {
+    triangle.Invert();
+  }
+  expectedResult.push_back(triangle);
+  bool triangleok = (pp.ConvexPartition_OPT(&triangle, &result, &optimal) == 1) && optimal;
+  pp.SetMemoryLimit(1);
+  triangleok = triangleok && (pp.ConvexPartition_OPT(&triangle, &triangleparts, &optimal) == 1) && !optimal;
+  pp.SetMemoryLimit(0);
+  if (triangleok && ComparePoly(&result, &expectedResult) && ComparePoly(&triangleparts, &expectedResult)) {
+    printf("success\n");
+  } else {
+    printf("failed\n");
+    failures++;
+  }
+
+  result.clear();
+  expectedResult.clear();
+
+  // Repeated calls with a workspace have to give the same results.
+  printf("Testing Triangulate_EC and Triangulate_MONO with a workspace: ");
+  TPPLWorkspace workspace;
+  TPPLPolyList expectedResult2;
+  bool same = true;
+  pp.SetWorkspace(&workspace);
+  ReadPolyList("test_triangulate_EC.txt", &expectedResult);
+  ReadPolyList("test_triangulate_MONO.txt", &expectedResult2);
+  for (int i = 0; i < 2; i++) {
+    pp.Triangulate_EC(&testpolys, &result);
+    same = same && ComparePoly(&result, &expectedResult);
+    result.clear();
+    pp.Triangulate_MONO(&testpolys, &result);
+    same = same && ComparePoly(&result, &expectedResult2);
+    result.clear();
+  }
+  pp.SetWorkspace(NULL);
+  if (same && (workspace.GetUsed() == 0)) {
+    printf("success\n");
+  } else {
+    printf("failed\n");
+    failures++;
+  }
+
+  result.clear();
+  expectedResult.clear();
+  expectedResult2.clear();
+
+  // The Triangulate_EC call nested in ConvexPartition_HM must not release
+  // the memory taken from the workspace before it.
+  printf("Testing ConvexPartition_HM with a new workspace: ");
+  TPPLWorkspace workspace2;
+  pp.ConvexPartition_HM(&testpolys.front(), &expectedResult);
+  pp.SetWorkspace(&workspace2);
+  pp.ConvexPartition_HM(&testpolys.front(), &result);
+  pp.SetWorkspace(NULL);
+  if (ComparePoly(&result, &expectedResult) && (workspace2.GetUsed() == 0)) {
+    printf("success\n");
+  } else {
+    printf("failed\n");
+    failures++;
+  }
+
+  // Once the workspace is large enough, writing to an index buffer must
+  // not allocate, with or without holes.
+  printf("Testing Triangulate_EC and Triangulate_MONO without allocations: ");
+  TPPLWorkspace workspace3;
+  TPPLPolyList noholes, holes;
+  long allocations = 0;
+  noholes.push_back(testpolys.front());
+  for (int i = 0; i < 10; i++) {
+    for (list<TPPLPoly>::iterator iter = testpolys.begin(); iter != testpolys.end(); iter++) {
+      holes.push_back(*iter);
+      for (long j = 0; j < iter->GetNumPoints(); j++) {
+        holes.back()[j].x += 1000 * i;
+      }
+    }
+  }
+  numtriangles = TPPLPartition::GetNumTriangles(&holes);
+  indices.assign(3 * numtriangles, 0);
+  long liveallocations = numallocations - numfrees;
+  pp.SetWorkspace(&workspace3);
+  for (int i = 0; i < 2; i++) {
+    allocations = numallocations;
+    pp.Triangulate_EC(&noholes, &indices[0]);
+    pp.Triangulate_EC(&holes, &indices[0]);
+    pp.Triangulate_MONO(&noholes, &indices[0]);
+    pp.Triangulate_MONO(&holes, &indices[0]);
+    allocations = numallocations - allocations;
+  }
+  pp.SetWorkspace(NULL);
+  // Clear has to free everything the workspace kept.
+  workspace3.Clear();
+  if ((allocations == 0) && (workspace3.GetSize() == 0) &&
+          (numallocations - numfrees == liveallocations)) {
+    printf("success\n");
+  } else {
+    printf("failed\n");
+    failures++;
+  }
+
+  result.clear();
+  expectedResult.clear();
+
+  // Large enough to be partitioned in parallel, the results have to
+  // come out as from a single thread.
+  printf("Testing Triangulate_EC and ConvexPartition_HM with threads: ");
+  TPPLPolyList batchpolys, result2;
+  vector<uint32_t> indices2;
+  for (int i = 0; i < 1000; i++) {
+    for (list<TPPLPoly>::iterator iter = testpolys.begin(); iter != testpolys.end(); iter++) {
+      batchpolys.push_back(*iter);
+      for (long j = 0; j < iter->GetNumPoints(); j++) {
+        batchpolys.back()[j].x += 1000 * i;
+      }
+    }
+  }
+  numtriangles = TPPLPartition::GetNumTriangles(&batchpolys);
+  indices.assign(3 * numtriangles, 0);
+  indices2.assign(3 * numtriangles, 0);
+  pp.Triangulate_EC(&batchpolys, &expectedResult);
+  pp.Triangulate_EC(&batchpolys, &indices[0]);
+  pp.ConvexPartition_HM(&batchpolys, &expectedResult2);
+  pp.SetNumThreads(4);
+  pp.Triangulate_EC(&batchpolys, &result);
+  pp.Triangulate_EC(&batchpolys, &indices2[0]);
+  pp.ConvexPartition_HM(&batchpolys, &result2);
+  pp.SetNumThreads(1);
+  if (ComparePoly(&result, &expectedResult) && (indices == indices2) &&
+          ComparePoly(&result2, &expectedResult2)) {
+    printf("success\n");
+  } else {
+    printf("failed\n");
+    failures++;
+  }
+
+  result.clear();
+  expectedResult.clear();
+
+  // A comb splits into many monotone pieces, which are triangulated
+  // in parallel.
+  printf("Testing Triangulate_MONO with threads: ");
+  TPPLPoly comb;
+  long numteeth = 60000;
+  comb.Init(4 * numteeth + 2);
+  comb[0].x = 0;
+  comb[0].y = 0;
+  comb[1].x = 2 * numteeth;
+  comb[1].y = 0;
+  for (long i = 0; i < numteeth; i++) {
+    comb[4 * i + 2].x = 2 * (numteeth - i);
+    comb[4 * i + 2].y = 10;
+    comb[4 * i + 3].x = 2 * (numteeth - i) - 1;
+    comb[4 * i + 3].y = 10;
+    comb[4 * i + 4].x = 2 * (numteeth - i) - 1;
+    comb[4 * i + 4].y = 1;
+    comb[4 * i + 5].x = 2 * (numteeth - i) - 2;
+    comb[4 * i + 5].y = 1;
+  }
+  numtriangles = TPPLPartition::GetNumTriangles(&comb);
+  indices.assign(3 * numtriangles, 0);
+  indices2.assign(3 * numtriangles, 0);
+  pp.Triangulate_MONO(&comb, &expectedResult);
+  pp.Triangulate_MONO(&comb, &indices[0]);
+  pp.SetNumThreads(4);
+  pp.Triangulate_MONO(&comb, &result);
+  pp.Triangulate_MONO(&comb, &indices2[0]);
+  pp.SetNumThreads(1);
+  if (((long)result.size() == numtriangles) && ComparePoly(&result, &expectedResult) &&
+          (indices == indices2)) {
+    printf("success\n");
+  } else {
+    printf("failed\n");
+    failures++;
+  }
+
+  result.clear();
+  result2.clear();
+
+  // Integer polygons with collinear vertices, vertices touching other
+  // edges, and ears with equal angles whose normalized cosines differ
+  // by rounding. The results differ from testing ears against all
+  // vertices and ordering them by the cosine, but they have to stay
+  // the same.
+  printf("Testing Triangulate_EC and ConvexPartition_HM on degenerate input: ");
+  TPPLPolyList degeneratepolys;
+  ReadPolyList("test_degenerate_input.txt", &degeneratepolys);
+  ReadPolyList("test_degenerate_EC.txt", &expectedResult);
+  ReadPolyList("test_degenerate_HM.txt", &expectedResult2);
+  if (pp.Triangulate_EC(&degeneratepolys, &result) && ComparePoly(&result, &expectedResult) &&
+          pp.ConvexPartition_HM(&degeneratepolys, &result2) && ComparePoly(&result2, &expectedResult2)) {
+    printf("success\n");
+  } else {
+    printf("failed\n");
+    failures++;
+  }
+
+  result.clear();
+  result2.clear();
+  expectedResult.clear();
+  expectedResult2.clear();
+
+  // Points rounded onto a line, on which convexity tests in plain
+  // floating point contradict each other.
+  printf("Testing nearly collinear points: ");
+  TPPLPoly line;
+  line.Init(51);
+  for (long i = 0; i < 50; i++) {
+    line[i].x = 0.1 + (i / 49.0) * (1.7 - 0.1);
+    line[i].y = 0.1 + (i / 49.0) * (1.4 - 0.1);
+  }
+  line[50].x = 0.1;
+  line[50].y = 1.4;
+  if (pp.Triangulate_EC(&line, &result) && pp.ConvexPartition_HM(&line, &result2) &&
+          ((long)result.size() == 49)) {
+    printf("success\n");
+  } else {
+    printf("failed\n");
+    failures++;
+  }
+
+  result.clear();
+  result2.clear();
+
+  // Apart from allocations and times, the statistics can't depend on
+  // the number of threads. They are all 0 unless the library is
+  // compiled with TPPL_STATS.
+  printf("Testing statistics with threads: ");
+  TPPLStats stats, stats2;
+  pp.SetStats(&stats);
+  pp.Triangulate_EC(&batchpolys, &result);
+  pp.ConvexPartition_HM(&batchpolys, &result);
+  pp.SetNumThreads(4);
+  pp.SetStats(&stats2);
+  pp.Triangulate_EC(&batchpolys, &result2);
+  pp.ConvexPartition_HM(&batchpolys, &result2);
+  pp.SetNumThreads(1);
+  pp.SetStats(NULL);
+  if (ComparePoly(&result, &result2) &&
+          (stats.numconvextests == stats2.numconvextests) &&
+          (stats.numintersecttests == stats2.numintersecttests) &&
+          (stats.numinsidetests == stats2.numinsidetests) &&
+          (stats.numvertexupdates == stats2.numvertexupdates) &&
+          (stats.numeartests == stats2.numeartests) &&
+          (stats.numholesbridged == stats2.numholesbridged)) {
+    printf("success\n");
+  } else {
+    printf("failed\n");
+    failures++;
+  }
+
+  result.clear();
+  result2.clear();
+  expectedResult.clear();
+
+  // Polygons written in the binary format and mapped back in
+  // have to be partitioned as before.
+  printf("Testing TPPLPolyFile: ");
+  TPPLPolyFile polyfile;
+  TPPLPolyList filepolys;
+  ReadPolyList("test_triangulate_EC.txt", &expectedResult);
+  same = TPPLPolyFile::Write("test_polys.bin", &testpolys) && polyfile.Open("test_polys.bin") &&
+          polyfile.GetPolys(&filepolys) && ComparePoly(&filepolys, &testpolys);
+  if (same) {
+    list<TPPLPoly>::iterator iter1 = filepolys.begin(), iter2 = testpolys.begin();
+    for (; iter1 != filepolys.end(); iter1++, iter2++) {
+      same = same && (iter1->IsHole() == iter2->IsHole());
+    }
+    pp.Triangulate_EC(&filepolys, &result);
+    same = same && ComparePoly(&result, &expectedResult) &&
+            TPPLPolyFile::Write("test_triangles.bin", &result);
+  }
+  filepolys.clear();
+  polyfile.Close();
+  same = same && polyfile.Open("test_triangles.bin") && polyfile.GetPolys(&filepolys) &&
+          ComparePoly(&filepolys, &expectedResult);
+  filepolys.clear();
+  polyfile.Close();
+  remove("test_polys.bin");
+  remove("test_triangles.bin");
+  if (same) {
+    printf("success\n");
+  } else {
+    printf("failed\n");
+    failures++;
+  }
+
+  result.clear();
+  expectedResult.clear();
+
+  // Flipping has to keep the covered area, leave every diagonal locally
+  // Delaunay and can only make the smallest angle larger. The list and
+  // index buffer versions have to flip the same diagonals.
+  printf("Testing FlipToDelaunay: ");
+  numtriangles = TPPLPartition::GetNumTriangles(&testpolys);
+  indices.assign(3 * numtriangles, 0);
+  pp.Triangulate_MONO(&testpolys, &indices[0]);
+  IndicesToPolyList(&testpolys, &indices[0], numtriangles, &expectedResult);
+  result = expectedResult;
+  same = pp.FlipToDelaunay(&testpolys, &indices[0]) && pp.FlipToDelaunay(&result) &&
+          IsDelaunay(&testpolys, &indices[0], numtriangles);
+  IndicesToPolyList(&testpolys, &indices[0], numtriangles, &result2);
+  same = same && ComparePoly(&result, &result2) &&
+          (fabs(GetArea(&result) - GetArea(&testpolys)) < 1e-6 * fabs(GetArea(&testpolys))) &&
+          (GetMinAngle(&result) >= GetMinAngle(&expectedResult));
+  for (list<TPPLPoly>::iterator iter = result.begin(); iter != result.end(); iter++) {
+    same = same && (iter->GetOrientation() == TPPL_ORIENTATION_CCW);
+  }
+  if (same) {
+    printf("success\n");
+  } else {
+    printf("failed\n");
+    failures++;
+  }
+  DrawPolyList("tri_delaunay.bmp", &result);
+
   return failures;
 }